@@ -0,0 +1,379 @@
+#include <benchmark/benchmark.h>
+#include <gc.h>
+#include <heap.h>
+#include <workload.h>
+#include <profiler.h>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+#define BENCH_HEAP_SIZE (64 * 1024 * 1024) // Room for the largest graphs below
+
+/**
+ * Google Benchmark calls each benchmark several times while it settles on
+ * an iteration count, so one heap is shared and remapped by every run
+ * instead of mapping a new one each time.
+ */
+static Heap shared_heap(BENCH_HEAP_SIZE);
+
+static Heap &fresh_heap() {
+    shared_heap.reset();
+    shared_heap.start();
+    return shared_heap;
+}
+
+// An object with two pointer fields, enough to build lists, trees and graphs
+typedef struct bench_node {
+    void *left;
+    void *right;
+    uintptr_t payload;
+} bench_node;
+
+/**
+ * Allocates an unrooted node. Graph builders keep only the head rooted, so
+ * every other node is found by the mark phase.
+ */
+static bench_node *new_node(GarbageCollector &gc, Heap &heap) {
+    size_t slot;
+    bench_node *node = (bench_node *)gc.malloc(sizeof(bench_node), &heap, &slot);
+    node->left = NULL;
+    node->right = NULL;
+    node->payload = 0;
+    gc.release_reference(slot);
+    return node;
+}
+
+// Request sizes: fixed sizes, then a small-object mix (range(0) == 0)
+static size_t request_size(mt19937 &rng, int64_t size) {
+    static const size_t mix[] = { 16, 16, 16, 24, 32, 32, 48, 64, 96, 128, 256, 512 };
+    return size ? (size_t)size : mix[rng() % (sizeof(mix) / sizeof(mix[0]))];
+}
+
+/**
+ * Heap::my_malloc/my_free round trips, freeing in random order so the free
+ * list fragments and coalesces as it would under a real workload. Sizes stay
+ * below LARGE_OBJECT_THRESHOLD; BM_Large_Malloc_Free times the mmap path.
+ */
+static void BM_Malloc_Free(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    mt19937 rng(42);
+    const size_t batch = 1024;
+    vector<void *> blocks(batch);
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            blocks[i] = heap.my_malloc(request_size(rng, state.range(0)));
+        }
+        shuffle(blocks.begin(), blocks.end(), rng);
+        for (size_t i = 0; i < batch; i++) {
+            heap.my_free(blocks[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_Malloc_Free)->Arg(0)->Arg(16)->Arg(64)->Arg(256)->Arg(LARGE_OBJECT_THRESHOLD - 1);
+
+/**
+ * Heap::my_malloc/my_free round trips in the large object space, where each
+ * block is its own mapping (range(0) is the request size).
+ */
+static void BM_Large_Malloc_Free(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    const size_t batch = 64;
+    vector<void *> blocks(batch);
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            blocks[i] = heap.my_malloc(state.range(0));
+        }
+        for (size_t i = 0; i < batch; i++) {
+            heap.my_free(blocks[i]);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_Large_Malloc_Free)->Arg(LARGE_OBJECT_THRESHOLD)->Arg(64 * 1024)->Arg(1024 * 1024);
+
+/**
+ * Fills a 1MB heap whose bottom is a run of 4096 small holes, under each
+ * placement policy (range(0) is a Heap::alloc_policy_t). First-fit rescans
+ * the holes for every request; next-fit resumes after its previous hit.
+ */
+static void BM_Fill_Fragmented(benchmark::State &state) {
+    Heap heap(1 << 20);
+    heap.set_policy((Heap::alloc_policy_t)state.range(0));
+    const size_t holes = 4096, hole_size = 16, block_size = 48;
+    vector<void *> freed(holes);
+    size_t filled = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        heap.reset();
+        for (size_t i = 0; i < holes; i++) {
+            freed[i] = heap.my_malloc(hole_size);
+            heap.my_malloc(hole_size);
+        }
+        heap.free_many(freed.data(), holes);
+        state.ResumeTiming();
+
+        while (heap.my_malloc(block_size)) filled++;
+    }
+    state.SetItemsProcessed(filled);
+}
+BENCHMARK(BM_Fill_Fragmented)->DenseRange(Heap::FIRST_FIT, Heap::NEXT_FIT)->Unit(benchmark::kMillisecond);
+
+/**
+ * GarbageCollector::malloc followed by a mark-and-sweep collection that
+ * frees the whole batch, i.e. the full cost of a short-lived object.
+ */
+static void BM_GC_Malloc_Collect(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    mt19937 rng(42);
+    const size_t batch = 1024;
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            size_t slot;
+            gc.malloc(request_size(rng, state.range(0)), &heap, &slot);
+            gc.release_reference(slot);
+        }
+        gc.ms_collect(&heap);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_GC_Malloc_Collect)->Arg(0)->Arg(16)->Arg(256);
+
+/**
+ * The small-object mix of BM_GC_Malloc_Collect with the allocation profiler
+ * off (range(0) == 0) or sampling every range(0) bytes on average.
+ */
+static void BM_GC_Malloc_Profiled(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    mt19937 rng(42);
+    const size_t batch = 1024;
+    if (state.range(0)) gc.start_profiling(state.range(0));
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            size_t slot;
+            gc.malloc(request_size(rng, 0), &heap, &slot);
+            gc.release_reference(slot);
+        }
+        gc.ms_collect(&heap);
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+}
+BENCHMARK(BM_GC_Malloc_Profiled)->Arg(0)->Arg(PROFILE_SAMPLE_RATE)->Arg(4096);
+
+/**
+ * Short-lived objects with a live set of 4096 nodes and no explicit
+ * collections: the pacer decides when to collect, range(0) being its
+ * GOGC-style percentage. Larger ratios trade memory for fewer collections.
+ */
+static void BM_GC_Paced(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    mt19937 rng(42);
+    const size_t batch = 1024;
+    gc.set_gc_percent(state.range(0));
+    size_t head_slot;
+    bench_node *head = (bench_node *)gc.malloc(sizeof(bench_node), &heap, &head_slot);
+    for (int i = 0; i < 4096; i++) {
+        bench_node *node = new_node(gc, heap);
+        node->left = head->left;
+        head->left = node;
+    }
+    gc.reset_stats();
+
+    for (auto _ : state) {
+        for (size_t i = 0; i < batch; i++) {
+            size_t slot;
+            benchmark::DoNotOptimize(gc.malloc(request_size(rng, 0), &heap, &slot));
+            gc.release_reference(slot);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * batch);
+    state.counters["collections"] = benchmark::Counter(gc.total_stats().collections,
+                                                       benchmark::Counter::kAvgIterations);
+    gc.release_reference(head_slot);
+}
+BENCHMARK(BM_GC_Paced)->Arg(25)->Arg(100)->Arg(400);
+
+/**
+ * Times collections over a live graph: nothing is freed, so the time is
+ * the mark phase plus a sweep that keeps everything.
+ */
+static void run_mark(benchmark::State &state, GarbageCollector &gc, Heap &heap) {
+    for (auto _ : state) {
+        gc.ms_collect(&heap);
+    }
+    state.SetItemsProcessed(state.iterations() * gc.last_stats().objects_marked);
+    state.SetBytesProcessed(state.iterations() * gc.last_stats().bytes_marked);
+    state.counters["mark_ns"] = gc.last_stats().mark_ns;
+}
+
+// A singly linked list: the worst case for mark stack depth
+static void BM_Mark_List(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    bench_node *head = new_node(gc, heap);
+    gc.add_reference(head);
+    bench_node *last = head;
+    for (int64_t i = 1; i < state.range(0); i++) {
+        bench_node *node = new_node(gc, heap);
+        last->left = node;
+        last = node;
+    }
+    run_mark(state, gc, heap);
+}
+BENCHMARK(BM_Mark_List)->Range(1 << 10, 1 << 18);
+
+// A complete binary tree, built breadth first
+static void BM_Mark_Tree(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    vector<bench_node *> nodes;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        nodes.push_back(new_node(gc, heap));
+        if (i > 0) {
+            bench_node *parent = nodes[(i - 1) / 2];
+            (i % 2 ? parent->left : parent->right) = nodes[i];
+        }
+    }
+    gc.add_reference(nodes[0]);
+    run_mark(state, gc, heap);
+}
+BENCHMARK(BM_Mark_Tree)->Range(1 << 10, 1 << 18);
+
+// Every node points at two random nodes; a spanning chain keeps all of them reachable
+static void BM_Mark_Random_Graph(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    mt19937 rng(42);
+    vector<bench_node *> nodes;
+    for (int64_t i = 0; i < state.range(0); i++) {
+        nodes.push_back(new_node(gc, heap));
+    }
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nodes[i]->left = i + 1 < nodes.size() ? nodes[i + 1] : NULL;
+        nodes[i]->right = nodes[rng() % nodes.size()];
+        nodes[i]->payload = (uintptr_t)nodes[rng() % nodes.size()];
+    }
+    gc.add_reference(nodes[0]);
+    run_mark(state, gc, heap);
+}
+BENCHMARK(BM_Mark_Random_Graph)->Range(1 << 10, 1 << 18);
+
+/**
+ * Sweep throughput against the fraction of dead objects (range(0) percent).
+ * Setup and the final cleanup are excluded from the timing.
+ */
+static void BM_Sweep_Dead_Ratio(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    mt19937 rng(42);
+    const size_t count = 1 << 16;
+    vector<size_t> slots(count);
+    size_t freed = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < count; i++) {
+            gc.malloc(32, &heap, &slots[i]);
+        }
+        for (size_t i = 0; i < count; i++) {
+            if ((int64_t)(rng() % 100) < state.range(0)) {
+                gc.release_reference(slots[i]);
+                slots[i] = (size_t)-1;
+            }
+        }
+        state.ResumeTiming();
+
+        gc.ms_collect(&heap);
+        freed += gc.last_stats().objects_freed;
+
+        state.PauseTiming();
+        for (size_t slot : slots) {
+            if (slot != (size_t)-1) gc.release_reference(slot);
+        }
+        gc.ms_collect(&heap);
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+    state.counters["freed_per_cycle"] = benchmark::Counter(freed, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_Sweep_Dead_Ratio)->DenseRange(0, 100, 25);
+
+// Cost of rooting and unrooting an object, which adjusts its reference count
+static void BM_RC_Inc_Dec(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    void *object = gc.malloc(32, &heap);
+
+    for (auto _ : state) {
+        size_t slot = gc.add_reference(object);
+        gc.release_reference(slot);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RC_Inc_Dec);
+
+// Reclaiming a batch of dead objects by reference counting
+static void BM_RC_Collect(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    const size_t count = state.range(0);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        for (size_t i = 0; i < count; i++) {
+            size_t slot;
+            gc.malloc(32, &heap, &slot);
+            gc.release_reference(slot);
+        }
+        state.ResumeTiming();
+        gc.rc_collect(&heap);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_RC_Collect)->Range(1 << 10, 1 << 16);
+
+/**
+ * A collection over a generated graph (range(0) is a workload_shape_t) of
+ * 64K objects in components of 256, half of which survive. Building the
+ * graph and freeing the survivors afterwards are excluded from the timing.
+ */
+static void BM_Workload(benchmark::State &state) {
+    Heap &heap = fresh_heap();
+    GarbageCollector gc;
+    workload_params params;
+    params.shape = (workload_shape_t)state.range(0);
+    params.objects = 1 << 16;
+    params.component = 256;
+    params.survival = 0.5;
+    size_t marked = 0;
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        GcWorkloadSink sink(gc, &heap);
+        generate_workload(params, sink);
+        state.ResumeTiming();
+
+        gc.ms_collect(&heap);
+        marked += gc.last_stats().objects_marked;
+
+        state.PauseTiming();
+        sink.release_roots();
+        gc.ms_collect(&heap);
+        state.ResumeTiming();
+    }
+    state.SetLabel(workload_shape_name(params.shape));
+    state.SetItemsProcessed(state.iterations() * params.objects);
+    state.counters["marked_per_cycle"] = benchmark::Counter(marked, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_Workload)->DenseRange(SHAPE_LIST, SHAPE_POWER_LAW);
+
+BENCHMARK_MAIN();
@@ -3,6 +3,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <iostream>
 #include <string>
@@ -10,29 +13,99 @@
 #include <vector>
 #include <set>
 #include <list>
+#include <mutex>
+#include <functional>
+#include <roots.h>
+#include <gc_stats.h>
 
 using namespace std;
+
+#define GC_MIN_TRIGGER 1024 // Bytes the pacer lets a nearly empty heap allocate between collections
+
 class Heap;
+class Region;
+class AllocationRecorder;
+class AllocationProfiler;
 
 class GarbageCollector {
     public:
         /**
-         * Metadata header stored with each allocated block.
+         * Metadata header stored with each allocated block, packed into one
+         * 64-bit word.
          * - `size` is the size of the user's allocated space (excluding the header).
          * - `marked` indicates if the block was visited during the mark phase.
+         * - `pointer_free` blocks hold no pointers and are never scanned.
+         * - `large` blocks live in the heap's large object space.
+         * - `slab` blocks are slots of a slab page.
+         * - `age` counts the collections the block survived, saturating at 15.
          */
         typedef struct allocation {
-            size_t size;
-            bool marked;
+            uint64_t size : 48;
+            uint64_t marked : 1;
+            uint64_t pointer_free : 1;
+            uint64_t large : 1;
+            uint64_t slab : 1;
+            uint64_t age : 4;
+            uint64_t unused : 8;
         } allocation;
 
         /**
          * Allocates memory on the given heap and registers the allocation.
          * @param size Number of bytes to allocate.
          * @param heap Pointer to the heap to allocate from.
+         * @param slot Optional output: root slot holding the new object, or
+         *             (size_t)-1 if no root was pushed (conservative mode).
+         * @return Pointer to the allocated memory (or NULL on failure).
+         */
+        void *malloc(size_t size, Heap *heap, size_t *slot = NULL);
+
+        /**
+         * Allocates memory for data that never holds heap pointers (strings,
+         * numeric arrays, ...). The mark phase does not scan it.
+         * @param size Number of bytes to allocate.
+         * @param heap Pointer to the heap to allocate from.
          * @return Pointer to the allocated memory (or NULL on failure).
          */
-        void *malloc(size_t size, Heap *heap);
+        void *malloc_atomic(size_t size, Heap *heap);
+
+        /**
+         * Allocates memory aligned to `align` bytes and registers the allocation.
+         * @param size Number of bytes to allocate.
+         * @param align Required alignment, a power of two (e.g. 64 for a cache line).
+         * @param heap Pointer to the heap to allocate from.
+         * @return Pointer to the allocated memory (or NULL on failure).
+         */
+        void *aligned_malloc(size_t size, size_t align, Heap *heap);
+
+        /**
+         * Allocates `count` objects of `size` bytes each and registers them
+         * in bulk. Objects are carved from as few free blocks as possible.
+         * @param count Number of objects to allocate.
+         * @param size Size of each object.
+         * @param heap Pointer to the heap to allocate from.
+         * @param out Output array of at least `count` entries.
+         * @return Number of objects allocated; fewer than `count` if the heap filled up.
+         */
+        size_t malloc_n(size_t count, size_t size, Heap *heap, void **out);
+
+        /**
+         * Frees an object immediately, without waiting for a collection.
+         * The caller guarantees nothing reachable still points to it; any
+         * root slots holding it are released.
+         * @param ptr Pointer to the object.
+         * @param heap Pointer to the heap the object was allocated from.
+         */
+        void free(void *ptr, Heap *heap);
+
+        /**
+         * Frees a batch of objects immediately. The heap sorts them by address
+         * and merges them into its free list in a single linear pass. An
+         * object listed more than once is freed once.
+         * @param ptrs Objects to free; the array is reordered.
+         * @param n Number of entries in `ptrs`.
+         * @param heap Pointer to the heap the objects were allocated from.
+         */
+        void free_many(void **ptrs, size_t n, Heap *heap);
 
         /**
          * Runs mark-and-sweep garbage collection.
@@ -52,9 +125,26 @@ class GarbageCollector {
          * Adds a pointer to the root set to simulate a live reference.
          * Increments the reference count of the object (if applicable).
          * @param ptr Pointer to the object to track.
-         * @return 0 if successful, -1 if the pointer was not found.
+         * @return Index of the root slot now holding `ptr`.
+         */
+        size_t add_reference(void *ptr);
+
+        /**
+         * Releases a root slot returned by add_reference().
+         * Decrements the reference count of the object it held.
+         * @param slot Index of the root slot.
+         * @return 0, or -1 if the slot is not in use (already released, or
+         *         dropped by a HandleScope).
+         */
+        int release_reference(size_t slot);
+
+        /**
+         * @param slot Index of a root slot.
+         * @return The pointer held in the slot, or NULL if it was released.
          */
-        void add_reference(void *ptr);
+        void *root(size_t slot) const {
+            return root_set.get(slot);
+        }
 
         /**
          * Adds a nested reference from one object to another, then increments
@@ -63,23 +153,231 @@ class GarbageCollector {
          * referencing.
          * @param src Pointer to the memory block that's being modified
          * @param dest Pointer to the memory block that's being referenced
+         * @param field Index of the pointer-sized field of `src` to write
          * @return 0 if successful, -1 on failure.
          */
-        int add_nested_reference(void *src, void *dest);
+        int add_nested_reference(void *src, void *dest, size_t field = 0);
 
         /**
          * Removes a pointer from the root set.
          * Decrements the reference count of the object (if applicable).
+         * Prefer release_reference() when the slot index is known; this
+         * has to search the root table from the top.
          * @param ptr Pointer to remove.
-         * @return 0 if successful, -1 if the pointer was not found.
          */
         void delete_reference(void *ptr);
 
+        /**
+         * Enables or disables conservative root scanning. When enabled, mark()
+         * also treats every word on the registered threads' stacks (and their
+         * spilled registers) as a potential root, and malloc() stops registering
+         * new objects in the root set: a pointer held in a local keeps the
+         * object alive. Objects allocated in this mode have no reference count
+         * entry, so they are only reclaimed by ms_collect().
+         * @param enabled True to turn conservative scanning on.
+         */
+        void set_conservative_roots(bool enabled);
+
+        /**
+         * Registers the calling thread's stack for conservative scanning.
+         * @param stack_base Highest address of the thread's stack, or NULL to
+         *                   look it up with pthread_getattr_np().
+         */
+        void register_thread(void *stack_base = NULL);
+
+        /**
+         * Removes the calling thread's stack from conservative scanning.
+         */
+        void unregister_thread();
+
+        /**
+         * Records the calling thread's current stack top and spills its registers
+         * so that a collection running on another thread can scan them. A
+         * registered thread must call this before it parks while another thread
+         * collects; the collecting thread scans itself live.
+         */
+        void safepoint();
+
+        /**
+         * Registers a region whose used bytes are scanned as roots by mark().
+         * Called by the Region constructor.
+         * @param region Region to scan.
+         */
+        void add_region(Region *region);
+
+        /**
+         * Stops scanning a region. Called when the region is released.
+         * @param region Region to forget.
+         */
+        void remove_region(Region *region);
+
+        /**
+         * @return What the most recent collection did and how long its phases took.
+         */
+        const GcStats &last_stats() const {
+            return cycle;
+        }
+
+        /**
+         * @return Totals and histograms over all collections since the last reset_stats().
+         */
+        const GcTotals &total_stats() const {
+            return totals;
+        }
+
+        /**
+         * Clears the totals and histograms returned by total_stats().
+         */
+        void reset_stats() {
+            totals = GcTotals();
+        }
+
+        /**
+         * Starts recording allocations, root and nested references, frees and
+         * collections to a compact binary trace that replay_trace() (and the
+         * gc_replay tool) can run against any heap configuration.
+         * @param path Trace file to create.
+         * @return True if the file could be created.
+         */
+        bool start_recording(const char *path);
+
+        /**
+         * Stops recording and closes the trace file.
+         * @return True if the whole trace was written.
+         */
+        bool stop_recording();
+
+        /**
+         * Starts sampling allocations by call site, discarding any previous
+         * profile. About one allocation per `sample_rate` bytes has its
+         * backtrace captured and is followed until it is freed.
+         * @param sample_rate Mean bytes between samples (PROFILE_SAMPLE_RATE
+         *                    is a good default); 1 samples every allocation.
+         */
+        void start_profiling(size_t sample_rate);
+
+        /**
+         * Stops sampling and discards the profile.
+         */
+        void stop_profiling();
+
+        /**
+         * @return The running profile, for AllocationProfiler::write_pprof()
+         *         and report(), or NULL when not profiling.
+         */
+        const AllocationProfiler *allocation_profile() const {
+            return profiler;
+        }
+
+        /**
+         * Writes every live block (address, size, header flags), the root set
+         * and the edges between blocks to a compact binary snapshot, for
+         * read_snapshot() and the gc_snapshot analyzer. Roots found by
+         * conservative stack scanning are not included.
+         * @param path File to create.
+         * @param heap The heap whose slab objects are included.
+         * @return True if the whole snapshot was written.
+         */
+        bool dump_snapshot(const char *path, Heap *heap);
+
+        /**
+         * Checks the collector's bookkeeping against the heap, after
+         * Heap::verify(): every `allocations` entry must be its block's own
+         * header in an allocated block (or a large object), every reference
+         * count must belong to a live object and cover the root slots holding
+         * it, and every root must be a live object.
+         * @param heap The heap the objects were allocated from.
+         * @param error Optional output: the first inconsistency found.
+         * @return True if everything is consistent.
+         */
+        bool verify(Heap *heap, string *error = NULL);
+
+        /**
+         * Turns on the pacer, which collects without being asked, like Go's
+         * GOGC: once the bytes allocated since the last collection reach
+         * `percent`% of the heap bytes in use after it (at least
+         * GC_MIN_TRIGGER), the next allocation runs ms_collect() first. An
+         * allocation the heap cannot satisfy also collects and retries, and
+         * only if that did not free enough grows the heap (up to
+         * Heap::max_heap_size) instead of failing. After a paced collection
+         * the heap is grown, if it can, so that the next trigger fits.
+         * While it is on, any object the program still uses must be rooted
+         * (or, in conservative mode, on a stack) across every allocation.
+         * @param percent Allowed growth over the live heap between
+         *                collections, e.g. 100; negative turns the pacer off,
+         *                which is the default.
+         * @return The previous setting.
+         */
+        int set_gc_percent(int percent);
+
+        /**
+         * @return Bytes that can still be allocated before the pacer
+         *         collects, or SIZE_MAX while it is off.
+         */
+        size_t next_collection() const;
+
+        /**
+         * Installs a function called with the objects freed by every
+         * collection, including those the pacer runs inside malloc(),
+         * whose lists the caller never sees.
+         * @param hook The function, or an empty one to remove it.
+         */
+        void set_collection_hook(function<void(const list<void*> &)> hook) {
+            collection_hook = hook;
+        }
+
+        /**
+         * In builds with DEBUGMODE defined, makes every collection end with
+         * verify() and abort on the first inconsistency. Off by default, as
+         * each check walks the whole heap.
+         * @param enabled True to verify after every collection.
+         */
+        void set_verify_collections(bool enabled) {
+            verify_collections = enabled;
+        }
+
+        ~GarbageCollector();
+
     protected:
+        friend class HandleScope;
+
+        /**
+         * Records a fresh heap block in `allocations` and, unless conservative
+         * roots are enabled, pushes a root for it.
+         * @param ptr Block returned by the heap.
+         * @return Index of the new root slot, or (size_t)-1 if none was pushed.
+         */
+        size_t track(void *ptr);
+
+        /**
+         * Body of malloc() and malloc_atomic().
+         * @param size Number of bytes to allocate.
+         * @param heap Pointer to the heap to allocate from.
+         * @param slot Optional output: root slot holding the new object.
+         * @param pointer_free True to mark the object as never holding pointers.
+         * @return Pointer to the allocated memory (or NULL on failure).
+         */
+        void *allocate(size_t size, Heap *heap, size_t *slot, bool pointer_free);
+
+        /**
+         * add_reference() without recording, for the root a new object starts with.
+         * @param ptr Pointer to add to the root set.
+         * @return Index of the root slot now holding `ptr`.
+         */
+        size_t push_root(void *ptr);
+
+        /**
+         * Releases every root slot at or above `top`, decrementing the
+         * reference counts of the objects they held.
+         * @param top Root table top saved when a HandleScope was opened.
+         */
+        void release_references(size_t top);
+
         /**
          * Performs the mark phase by traversing the root set and marking reachable objects.
+         * @param heap The heap whose slab objects are marked alongside `allocations`.
          */
-        void mark();
+        void mark(Heap *heap);
 
         /**
          * Performs the sweep phase by freeing all unmarked objects in the allocations map.
@@ -88,10 +386,83 @@ class GarbageCollector {
         list<void*> sweep(Heap *heap);
 
         /**
-         * Recursively walks the contents of a memory block, marking any reachable pointers found.
-         * @param ptr Pointer to the start of a block to walk.
+         * Marks an object if `ptr` is the start of one and it is not marked yet.
+         * @param ptr Candidate pointer.
+         * @param heap The heap whose slabs are consulted.
+         * @return True if the object was newly marked.
+         */
+        bool mark_object(void *ptr, Heap *heap);
+
+        /**
+         * Walks the contents of the marked blocks on the mark stack and
+         * everything reachable from them, marking any reachable pointers found.
+         * @param heap The heap whose slabs are consulted.
+         */
+        void drain_mark_stack(Heap *heap);
+
+        /**
+         * Conservatively scans every registered thread stack, marking any word
+         * that points into a tracked allocation. Interior pointers count, since
+         * compilers are free to keep only a derived pointer in a register.
+         */
+        void scan_thread_stacks(Heap *heap);
+
+        /**
+         * Marks the allocation containing `word`, if there is one, and pushes
+         * it onto the mark stack.
+         * @param word A value that may or may not be a heap pointer.
+         * @param heap The heap whose slabs are consulted.
+         */
+        void mark_conservative(uintptr_t word, Heap *heap);
+
+        /**
+         * Runs verify() if set_verify_collections() enabled it, and aborts
+         * with the inconsistency found, if any.
+         * @param heap The heap just collected.
+         * @param collector Name of the collection, for the message.
+         */
+        void verify_collection(Heap *heap, const char *collector);
+
+        /**
+         * Counts an allocation of `bytes` against the pacer's trigger and
+         * collects when it is reached, growing the heap afterwards if the
+         * live data left too little room for the next trigger.
+         * @param bytes Bytes about to be allocated.
+         * @param heap The heap being allocated from.
+         */
+        void pace(size_t bytes, Heap *heap);
+
+        /**
+         * Called by the allocation functions when the heap could not satisfy
+         * a request, while the pacer is on: the first attempt collects, the
+         * second grows the heap by `bytes` plus the pacer's headroom.
+         * @param bytes Heap bytes (headers included) the request needs, or 0
+         *              for a large object, which growing the heap cannot help.
+         * @param heap The heap being allocated from.
+         * @param attempt How many times the request has already been retried.
+         * @return True if the allocation is worth retrying.
+         */
+        bool make_room(size_t bytes, Heap *heap, int attempt);
+
+        /**
+         * ms_collect() started by pace() or make_room(); recorded as
+         * OP_MS_PACED.
+         * @param heap The heap being allocated from.
          */
-        void walk_block(void *ptr);
+        void paced_collect(Heap *heap);
+
+        /**
+         * @return Bytes the pacer lets the program allocate between collections.
+         */
+        size_t pacer_trigger() const;
+
+        /**
+         * Resets the pacer's count and live size and calls the collection
+         * hook, at the end of every collection.
+         * @param heap The heap just collected.
+         * @param deleted Objects the collection freed.
+         */
+        void collection_done(Heap *heap, const list<void*> &deleted);
 
         /**
          * Used internally by both reference counting (`rc_collect`) and mark-and-sweep (`ms_collect`)
@@ -113,9 +484,10 @@ class GarbageCollector {
         /**
          * Simulated root references (acting like stack/global pointers).
          * Any pointer here is treated as a live root for the mark phase.
-         * Can be modified using add_reference() and delete_reference().
+         * Can be modified using add_reference(), release_reference(),
+         * delete_reference() and HandleScope.
          */
-        multiset<void*> root_set;
+        RootTable root_set;
 
         /**
          * Reference counts for each allocated object.
@@ -123,6 +495,42 @@ class GarbageCollector {
          */
         map<void*, int> reference_count;
 
+        /**
+         * A thread whose stack is scanned when conservative roots are enabled.
+         * `stack_top` and `registers` are refreshed by safepoint().
+         */
+        typedef struct thread_root {
+            pthread_t thread;
+            void *stack_base;
+            void *stack_top;
+            jmp_buf registers;
+        } thread_root;
+
+        /**
+         * Live regions. Their contents act as roots, and the heap is never
+         * reset while one of them holds a block.
+         */
+        list<Region*> regions;
+
+        vector<void*> mark_stack;        // Marked blocks still to be scanned.
+
+        GcStats cycle = {}; // The collection in progress, or the last one.
+        GcTotals totals;    // Every collection since the last reset_stats().
+
+        AllocationRecorder *recorder = NULL; // Trace being recorded, if any.
+        AllocationProfiler *profiler = NULL; // Allocation sampling, if enabled.
+
+        list<thread_root> threads;       // Registered thread stacks.
+        mutex threads_lock;              // Guards `threads` during (un)registration.
+        bool conservative_roots = false; // Whether mark() scans thread stacks.
+        bool verify_collections = false; // Whether collections end with verify() (DEBUGMODE only).
+
+        int gc_percent = -1;           // Pacer ratio (GOGC); negative while the pacer is off.
+        size_t allocated_since_gc = 0; // Bytes allocated since the last collection.
+        size_t live_after_gc = 0;      // Heap bytes in use after the last collection.
+        bool pacing = false;           // Whether the running collection was started by the pacer.
+        function<void(const list<void*> &)> collection_hook; // Called after every collection.
+
 };
 
 #endif
@@ -0,0 +1,128 @@
+#ifndef __GC_PTR_H
+#define __GC_PTR_H
+#include <new>
+#include <type_traits>
+#include <gc.h>
+#include <heap.h>
+
+/**
+ * Owning root handle for a collected object. A gc_ptr holds one root slot
+ * for its lifetime and releases it when destroyed, so every add_reference()
+ * is paired with a release. It is the size of a raw pointer plus a slot
+ * index: the object pointer itself is read back from the root slot.
+ *
+ * - Copying pushes a new root slot (O(1), no allocation in the common case).
+ * - Moving hands the slot over and leaves the source empty; reference
+ *   counts are not touched.
+ *
+ * A gc_ptr must not outlive the HandleScope it was created in (or, for a
+ * copy, the scope of the copy). Closing the scope truncates the root table
+ * without telling the handles, so a handle left behind keeps an index
+ * that a later root may reuse: destroying or resetting it would then
+ * release that other object's root, and copying it would root whatever
+ * the slot holds. Create long-lived handles outside any scope.
+ */
+template <typename T>
+class gc_ptr {
+    public:
+        gc_ptr() : gc(NULL), slot(0) {}
+
+        /**
+         * Roots `ptr` in a new slot of `gc`.
+         * @param gc Collector owning the object.
+         * @param ptr Object to root (as returned by GarbageCollector::malloc).
+         */
+        gc_ptr(GarbageCollector &gc, T *ptr) : gc(&gc), slot(gc.add_reference(ptr)) {}
+
+        /**
+         * Takes over a root slot that is already held, without pushing a new one.
+         * @param gc Collector owning the slot.
+         * @param slot Index of the slot to adopt.
+         */
+        static gc_ptr adopt(GarbageCollector &gc, size_t slot) {
+            gc_ptr handle;
+            handle.gc = &gc;
+            handle.slot = slot;
+            return handle;
+        }
+
+        gc_ptr(const gc_ptr &other) : gc(other.gc), slot(0) {
+            if (gc) slot = gc->add_reference(other.get());
+        }
+
+        gc_ptr(gc_ptr &&other) noexcept : gc(other.gc), slot(other.slot) {
+            other.gc = NULL;
+        }
+
+        gc_ptr &operator=(const gc_ptr &other) {
+            if (this != &other) {
+                GarbageCollector *other_gc = other.gc;
+                size_t other_slot = other_gc ? other_gc->add_reference(other.get()) : 0;
+                reset();
+                gc = other_gc;
+                slot = other_slot;
+            }
+            return *this;
+        }
+
+        gc_ptr &operator=(gc_ptr &&other) noexcept {
+            if (this != &other) {
+                reset();
+                gc = other.gc;
+                slot = other.slot;
+                other.gc = NULL;
+            }
+            return *this;
+        }
+
+        ~gc_ptr() {
+            reset();
+        }
+
+        /**
+         * Releases the root slot (if any) and leaves the handle empty.
+         */
+        void reset() {
+            if (gc) {
+                gc->release_reference(slot);
+                gc = NULL;
+            }
+        }
+
+        /**
+         * @return The rooted object, or NULL for an empty handle.
+         */
+        T *get() const {
+            return gc ? (T *)gc->root(slot) : NULL;
+        }
+
+        T &operator*() const { return *get(); }
+        T *operator->() const { return get(); }
+        explicit operator bool() const { return gc != NULL; }
+
+    private:
+        GarbageCollector *gc; // Collector holding the slot, NULL when empty.
+        size_t slot;          // Index of the root slot.
+};
+
+/**
+ * Allocates and value-initialises a T on `heap`, returning a handle that owns
+ * the root created by the allocation. Objects are reclaimed without running
+ * destructors, so T must be trivially destructible.
+ * @param gc Collector to allocate through.
+ * @param heap Heap to allocate from.
+ * @return Handle to the new object, or an empty handle if the heap is full.
+ */
+template <typename T>
+gc_ptr<T> gc_new(GarbageCollector &gc, Heap *heap) {
+    static_assert(is_trivially_destructible<T>::value,
+                  "collected objects are freed without running destructors");
+    size_t slot;
+    void *ptr = gc.malloc(sizeof(T), heap, &slot);
+    if (!ptr) return gc_ptr<T>();
+    new (ptr) T();
+    if (slot == (size_t)-1) return gc_ptr<T>(gc, (T *)ptr);
+    return gc_ptr<T>::adopt(gc, slot);
+}
+
+#endif
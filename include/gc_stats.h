@@ -0,0 +1,114 @@
+#ifndef __GC_STATS_H
+#define __GC_STATS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#define GC_HISTOGRAM_BUCKETS 64 // One bucket per power of two of a uint64_t
+
+/**
+ * @return A monotonic timestamp in nanoseconds, used to time GC phases.
+ */
+static inline uint64_t gc_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Log2 histogram: bucket 0 counts zeroes and bucket i counts values in
+ * [2^(i-1), 2^i). Recording is a count-leading-zeros and an increment, so
+ * it can stay on in production.
+ */
+class GcHistogram {
+    public:
+        GcHistogram() {
+            clear();
+        }
+
+        /**
+         * Adds one sample.
+         * @param value The sample.
+         */
+        void record(uint64_t value);
+
+        /**
+         * Forgets every sample.
+         */
+        void clear();
+
+        /**
+         * Approximates a quantile by the upper bound of the bucket it falls in.
+         * @param q Quantile in [0, 1], e.g. 0.99.
+         * @return An upper bound on the q-quantile, or 0 without samples.
+         */
+        uint64_t quantile(double q) const;
+
+        /**
+         * @return The mean of the samples, or 0 without samples.
+         */
+        double mean() const {
+            return count ? (double)sum / count : 0.0;
+        }
+
+        uint64_t buckets[GC_HISTOGRAM_BUCKETS]; // Samples per power-of-two bucket.
+        uint64_t count;                         // Number of samples.
+        uint64_t sum;                           // Sum of the samples.
+        uint64_t min;                           // Smallest sample (UINT64_MAX without samples).
+        uint64_t max;                           // Largest sample.
+};
+
+/**
+ * What one collection did and how long each phase took. Times are in
+ * nanoseconds. Reference counting has no clear, root scan or mark phase,
+ * so those fields stay 0 for it.
+ */
+typedef struct GcStats {
+    typedef enum {
+        MARK_SWEEP,
+        REF_COUNT
+    } kind_t;
+
+    kind_t kind;
+
+    uint64_t clear_ns;     // Clearing mark bits.
+    uint64_t root_scan_ns; // Root slots, regions and thread stacks.
+    uint64_t mark_ns;      // Draining the mark stack.
+    uint64_t sweep_ns;     // Finding dead objects (and slab bitmap sweeps).
+    uint64_t coalesce_ns;  // Returning dead blocks to the free list and scavenging.
+    uint64_t pause_ns;     // The whole collection.
+
+    size_t objects_marked; // Objects reached by the mark phase.
+    size_t bytes_marked;   // Payload bytes of those objects.
+    size_t objects_freed;  // Objects reclaimed.
+    size_t bytes_freed;    // Payload bytes of those objects.
+    size_t words_scanned;  // Words examined as potential pointers.
+    size_t false_positives; // Conservative words inside the heap span that matched no object.
+} GcStats;
+
+/**
+ * Running totals over every collection since the last reset, with
+ * histograms of the pause, the mark and sweep phases and the bytes freed.
+ */
+typedef struct GcTotals {
+    size_t collections = 0;    // Number of collections of either kind.
+    size_t ms_collections = 0; // Number of mark-and-sweep collections.
+    size_t rc_collections = 0; // Number of reference counting collections.
+    size_t objects_freed = 0;
+    size_t bytes_freed = 0;
+    size_t words_scanned = 0;
+    size_t false_positives = 0;
+
+    GcHistogram pause_ns;
+    GcHistogram mark_ns;
+    GcHistogram sweep_ns;
+    GcHistogram bytes_freed_per_cycle;
+
+    /**
+     * Folds one collection into the totals.
+     * @param cycle The finished collection.
+     */
+    void add(const GcStats &cycle);
+} GcTotals;
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef __GC_TRACE_H
+#define __GC_TRACE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+#define GC_TRACE_RING_RECORDS 65536 // Records kept per thread (a power of two)
+#define GC_TRACE_MAGIC "GCTRACE1"   // First 8 bytes of a trace file
+
+/**
+ * Events recorded by the trace points. Collections and their phases are
+ * begin/end pairs; allocations and frees are instants.
+ */
+typedef enum {
+    TRACE_MALLOC,       // arg0 = size, arg1 = pointer
+    TRACE_FREE,         // arg0 = pointer
+    TRACE_FREE_MANY,    // arg0 = number of blocks
+    TRACE_LARGE_MALLOC, // arg0 = size, arg1 = pointer
+    TRACE_LARGE_FREE,   // arg0 = pointer
+    TRACE_MS_COLLECT,   // end: arg0 = objects freed, arg1 = bytes freed
+    TRACE_RC_COLLECT,   // end: arg0 = objects freed, arg1 = bytes freed
+    TRACE_CLEAR,
+    TRACE_ROOT_SCAN,
+    TRACE_MARK,         // end: arg0 = objects marked
+    TRACE_SWEEP,
+    TRACE_COALESCE,
+    TRACE_SCAVENGE,     // end: arg0 = bytes released
+    TRACE_HEAP_GROW,    // arg0 = bytes added, arg1 = new heap size
+    TRACE_EVENT_COUNT
+} gc_trace_event_t;
+
+/**
+ * One fixed-size trace record. `phase` uses the Chrome trace letters:
+ * 'B' begins a span, 'E' ends it and 'i' is an instant.
+ */
+typedef struct gc_trace_record {
+    uint64_t timestamp_ns; // gc_now_ns() when the record was written
+    uint64_t arg0;
+    uint64_t arg1;
+    uint32_t thread;       // Small id given to each thread on its first record
+    uint16_t event;        // A gc_trace_event_t
+    uint16_t phase;
+} gc_trace_record;
+
+/**
+ * Appends a record to the calling thread's ring buffer, overwriting the
+ * oldest record once the ring is full. Only the owning thread writes a
+ * ring, so no lock is taken; the first record of a thread registers its
+ * ring under a mutex.
+ * @param event What happened.
+ * @param phase 'B', 'E' or 'i'.
+ * @param arg0 Event specific argument.
+ * @param arg1 Event specific argument.
+ */
+void gc_trace_emit(gc_trace_event_t event, char phase, uint64_t arg0 = 0, uint64_t arg1 = 0);
+
+/**
+ * Discards every record in every ring. Safe while other threads trace;
+ * records they write afterwards are kept.
+ */
+void gc_trace_clear();
+
+/**
+ * Writes the records of every ring to a binary file: GC_TRACE_MAGIC, the
+ * record count as a uint64_t, then the raw records.
+ * @param path File to create.
+ * @return Number of records written, or -1 if the file cannot be written.
+ */
+long gc_trace_write(const char *path);
+
+/**
+ * Reads a file written by gc_trace_write().
+ * @param path File to read.
+ * @param records Output: the records, sorted by timestamp.
+ * @return True on success, false if the file is missing or malformed.
+ */
+bool gc_trace_read(const char *path, vector<gc_trace_record> &records);
+
+/**
+ * Formats records as Chrome trace JSON, which Perfetto and chrome://tracing
+ * load directly. Timestamps become microseconds.
+ * @param records Records sorted by timestamp.
+ * @param out Stream to write to.
+ */
+void gc_trace_to_json(const vector<gc_trace_record> &records, ostream &out);
+
+/**
+ * @param event A gc_trace_event_t.
+ * @return Its name in trace output.
+ */
+const char *gc_trace_event_name(uint16_t event);
+
+/**
+ * Trace points. They compile to nothing unless GC_TRACE is defined
+ * (`make TRACE=-DGC_TRACE`), so an untraced build pays nothing for them.
+ */
+#ifdef GC_TRACE
+#define GC_TRACE_BEGIN(event) gc_trace_emit(event, 'B')
+#define GC_TRACE_END(event, ...) gc_trace_emit(event, 'E', ##__VA_ARGS__)
+#define GC_TRACE_INSTANT(event, ...) gc_trace_emit(event, 'i', ##__VA_ARGS__)
+#else
+#define GC_TRACE_BEGIN(event) ((void)0)
+#define GC_TRACE_END(event, ...) ((void)0)
+#define GC_TRACE_INSTANT(event, ...) ((void)0)
+#endif
+
+#endif
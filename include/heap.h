@@ -2,14 +2,21 @@
 #define __HEAP_H
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <sys/mman.h>
 #include <iostream>
 #include <string>
 #include <map>
+#include <vector>
+#include <set>
 #include <gc.h>
 
 using namespace std;
 #define HEAP_SIZE 4096 // 4KB
+#define LARGE_OBJECT_THRESHOLD (HEAP_SIZE / 4) // Requests this big get their own mapping
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) // 2MB, x86-64 PMD page size
+#define HEAP_ALIGN 16 // Minimum alignment of every block handed out
+#define SLAB_SLOTS 64 // Slots per slab page, one bit each in a 64-bit bitmap
 
 class Heap {
     public:
@@ -19,13 +26,63 @@ class Heap {
             struct __node_t *next; // Pointer to the next free block
         } node_t;
     
+        // A large object living in its own page-aligned mapping
+        typedef struct large_object {
+            char *base;    // Start of the mapping
+            size_t length; // Length of the mapping in bytes
+            size_t offset; // Payload offset from base; the allocation header sits just below it
+        } large_object;
+
+        // How the heap mapping is backed
+        typedef enum {
+            PAGES_NORMAL,           // Plain anonymous mmap
+            PAGES_TRANSPARENT_HUGE, // 2MB aligned, madvise(MADV_HUGEPAGE)
+            PAGES_HUGETLB           // MAP_HUGETLB, falling back to transparent huge pages
+        } page_mode_t;
+
+        /**
+         * Header of a slab page: SLAB_SLOTS equal-sized slots carved from one
+         * free-list block, each slot being an allocation header plus
+         * `slot_size` payload bytes. Bit i of a bitmap describes slot i.
+         */
+        typedef struct slab_t {
+            size_t slot_size;   // Payload bytes per slot (the size class)
+            uint64_t allocated; // Slots holding an object
+            uint64_t marked;    // Slots reached by the current mark phase
+        } slab_t;
+
+        // How find_free() picks among the blocks that fit
+        typedef enum {
+            FIRST_FIT, // Lowest address, walking the free list
+            BEST_FIT,  // Smallest block, from a size-ordered tree (O(log n))
+            NEXT_FIT   // First block after the previous hit, wrapping around
+        } alloc_policy_t;
+
         node_t *head; // Pointer to the start of the free list
         node_t *tail; // Pointer to the end sentinel of the heap
+
+        size_t heap_size;       // Size of the free-list heap region in bytes
+        size_t max_heap_size;   // Size grow() may extend heap_size to, reserved when the heap is mapped
+        size_t large_threshold; // Requests of at least this many bytes go to the large object space
+        size_t scavenge_retain; // Free bytes scavenge() keeps resident (SIZE_MAX disables it)
+        page_mode_t pages;      // Page backing used the next time the heap is mapped
     
         // Constructor
-        Heap() {
+        Heap(size_t size = HEAP_SIZE, page_mode_t pages = PAGES_NORMAL) {
             head = NULL;
             tail = NULL;
+            heap_base = NULL;
+            map_length = 0;
+            heap_size = size;
+            max_heap_size = 0;
+            committed = 0;
+            this->pages = pages;
+            policy = FIRST_FIT;
+            rover = NULL;
+            free_bytes = 0;
+            free_blocks = 0;
+            large_threshold = LARGE_OBJECT_THRESHOLD;
+            scavenge_retain = SIZE_MAX;
         }
     
         /**
@@ -36,26 +93,224 @@ class Heap {
     
         /**
          * Resets the heap by unmapping and reinitializing it.
+         * Every large object is unmapped as well.
          */
         void reset();
     
         /**
          * Returns the total amount of free memory currently available in the heap.
+         * Read from a running counter, so it never walks the free list.
          * @return Size in bytes of available memory.
          */
         size_t available_memory();
     
+        /**
+         * @return Bytes of the free-list heap taken by allocated blocks,
+         *         headers included (the large object space is not counted).
+         */
+        size_t used_memory();
+    
+        /**
+         * @return Number of blocks on the free list.
+         */
+        size_t free_block_count();
+    
+        /**
+         * @return Size of the largest free block, in the units of available_memory().
+         */
+        size_t largest_free_block();
+    
+        /**
+         * External fragmentation of the free space: 0 when all free memory is
+         * one block, approaching 1 as it is spread over many small blocks.
+         * @return 1 - largest_free_block() / available_memory(), or 0 when nothing is free.
+         */
+        double fragmentation();
+    
+        /**
+         * Returns fully free pages inside free blocks to the OS, keeping the
+         * first `scavenge_retain` free bytes resident. Does nothing while
+         * `scavenge_retain` is SIZE_MAX. Called after every collection.
+         * @return Number of bytes released.
+         */
+        size_t scavenge();
+    
+        /**
+         * Extends the heap in place by `bytes` (rounded up to HEAP_ALIGN):
+         * commits the next pages of the reservation, moves the tail
+         * sentinel, and frees the new space, coalescing it with a free block
+         * that ended at the old tail.
+         * @param bytes Number of bytes to add to heap_size.
+         * @return False if that would exceed max_size() or mprotect fails.
+         */
+        bool grow(size_t bytes);
+
+        /**
+         * @return The largest heap_size grow() can reach: the max_heap_size
+         *         reserved when the heap was mapped, or heap_size for a heap
+         *         that cannot grow.
+         */
+        size_t max_size() {
+            Heap::start();
+            return map_length - sizeof(node_t);
+        }
+    
         /**
          * Prints a visual representation of the free list, showing block sizes.
          */
         void print_free_list();
+
+        /**
+         * Checks the heap's integrity: walks it physically from the first
+         * block to the tail sentinel and checks that free and allocated
+         * blocks tile it exactly with aligned headers, that the free list is
+         * in address order with no two neighbours left uncoalesced, that the
+         * free space counters and best-fit trees match the list, and that
+         * the slabs and the large object table are well formed.
+         * O(heap size); meant for debug builds and tests.
+         * @param error Optional output: the first inconsistency found.
+         * @param blocks Optional output: the payload of every allocated block
+         *               of the free-list heap, in address order.
+         * @return True if the heap is consistent.
+         */
+        bool verify(string *error = NULL, vector<void*> *blocks = NULL);
+
+        /**
+         * @param ptr Any pointer.
+         * @return True if `ptr` is the payload of a live large object.
+         */
+        bool is_large_object(void *ptr);
     
         /**
-         * Allocates a block of memory from the heap.
+         * Allocates a block of memory from the heap. The size is rounded up to
+         * a multiple of HEAP_ALIGN, so the result is HEAP_ALIGN aligned.
+         * Requests of at least `large_threshold` bytes are served by
+         * large_malloc() instead.
          * @param size Number of bytes to allocate.
          * @return Pointer to the usable memory block or NULL if allocation fails.
          */
         void *my_malloc(size_t size);
+
+        /**
+         * Free-list part of my_malloc(), bypassing the large object threshold,
+         * for blocks that must live inside the heap whatever their size.
+         * @param size Number of bytes to allocate.
+         * @return Pointer to the usable memory block or NULL if allocation fails.
+         */
+        void *free_list_malloc(size_t size);
+    
+        /**
+         * Allocates a block whose address is a multiple of `align`.
+         * @param size Number of bytes to allocate.
+         * @param align Required alignment (a power of two).
+         * @return Pointer to the aligned memory or NULL if allocation fails.
+         */
+        void *my_aligned_malloc(size_t size, size_t align);
+    
+        /**
+         * Rounds a request up to the allocation granularity: blocks (header
+         * plus payload) are whole multiples of HEAP_ALIGN, and every header
+         * sits just below a HEAP_ALIGN boundary so the payload is aligned.
+         * @param size Number of bytes requested.
+         * @return The payload size of the smallest block that holds `size` bytes.
+         */
+        static size_t align_size(size_t size) {
+            size_t block = (size + sizeof(GarbageCollector::allocation) + HEAP_ALIGN - 1)
+                           & ~(size_t)(HEAP_ALIGN - 1);
+            return block - sizeof(GarbageCollector::allocation);
+        }
+
+        /**
+         * @param block A free block.
+         * @return Payload bytes available if the whole block were allocated.
+         */
+        static size_t capacity(node_t *block) {
+            return block->size + sizeof(node_t) - sizeof(GarbageCollector::allocation);
+        }
+    
+        /**
+         * Allocates up to `count` blocks of `size` bytes, carving as many as
+         * possible out of each free block it visits in a single list pass.
+         * @param count Number of blocks wanted.
+         * @param size Size of each block.
+         * @param out Output array of at least `count` entries, filled in address order.
+         * @return Number of blocks actually allocated.
+         */
+        size_t my_malloc_n(size_t count, size_t size, void **out);
+    
+        /**
+         * Enables slab allocation for one size class. Requests that round up
+         * to `size` are then served by slab_malloc().
+         * @param size Payload size of the class; rounded up to HEAP_ALIGN.
+         */
+        void add_size_class(size_t size);
+    
+        /**
+         * Allocates a slot from a slab of the matching size class, carving a
+         * new slab page from the free list when every slab of the class is full.
+         * @param size Number of bytes to allocate.
+         * @return Pointer to the slot's payload, or NULL if there is no class
+         *         for `size` or no room for a new slab.
+         */
+        void *slab_malloc(size_t size);
+    
+        /**
+         * Finds the slab slot containing `ptr` (interior pointers included).
+         * @param ptr Address to look up.
+         * @param slot Output: index of the slot within the slab.
+         * @return The slab, or NULL if `ptr` is not inside an allocated slot.
+         */
+        slab_t *slab_find(void *ptr, unsigned *slot);
+    
+        /**
+         * @param slab A slab page.
+         * @param slot Index of a slot in it.
+         * @return The payload address of the slot.
+         */
+        static void *slab_payload(slab_t *slab, unsigned slot) {
+            return (char *)slab + sizeof(slab_t) +
+                   slot * (sizeof(GarbageCollector::allocation) + slab->slot_size) +
+                   sizeof(GarbageCollector::allocation);
+        }
+    
+        /**
+         * @param ptr Address to test.
+         * @return True if `ptr` is the payload address of an allocated slab slot.
+         */
+        bool is_slab_object(void *ptr);
+    
+        /**
+         * Clears the allocated bit of the slot holding `ptr`.
+         * @param ptr Pointer returned by slab_malloc().
+         * @return True if `ptr` was a slab object.
+         */
+        bool slab_free(void *ptr);
+    
+        /**
+         * Clears the mark bitmap of every slab.
+         */
+        void slab_clear_marks();
+    
+        /**
+         * Sweeps every slab with word-parallel bit operations: unmarked
+         * slots are freed by `allocated &= marked`. Slabs left empty are
+         * returned to the free list.
+         * @param freed Output: payload addresses of the slots freed.
+         */
+        void slab_sweep(vector<void*> &freed);
+
+        /**
+         * Lists every allocated slab object, in address order.
+         * @param objects Output: payload addresses are appended.
+         */
+        void slab_objects(vector<void*> &objects);
+    
+        /**
+         * @return Number of slab pages currently carved from the heap.
+         */
+        size_t slab_count() {
+            return slabs.size();
+        }
     
         /**
          * Frees a previously allocated block and returns it to the free list.
@@ -63,6 +318,58 @@ class Heap {
          */
         void my_free(void *allocated);
     
+        /**
+         * Frees a batch of allocated blocks. The blocks are sorted by address
+         * and merged with the free list in one pass, coalescing neighbours.
+         * Duplicates are freed once.
+         * @param blocks Pointers returned by my_malloc(); the array is sorted in place.
+         * @param n Number of entries in `blocks`.
+         */
+        void free_many(void **blocks, size_t n);
+    
+        /**
+         * Allocates a block in the large object space: a private mapping
+         * rounded up to whole pages, with the payload `align` bytes in.
+         * @param size Number of bytes to allocate.
+         * @param align Payload alignment, from HEAP_ALIGN up to the page size.
+         * @return Pointer to the usable memory or NULL if mmap fails.
+         */
+        void *large_malloc(size_t size, size_t align = HEAP_ALIGN);
+
+        /**
+         * Looks up a large object by its payload pointer.
+         * @param ptr Pointer to look up.
+         * @return Its large object table entry, or large_objects.end().
+         */
+        vector<large_object>::iterator find_large_object(void *ptr);
+    
+        /**
+         * Unmaps a large object.
+         * @param allocated Pointer returned by large_malloc().
+         * @return True if `allocated` was a large object, false if it belongs to the free-list heap.
+         */
+        bool large_free(void *allocated);
+    
+        /**
+         * @return Number of live objects in the large object space.
+         */
+        size_t large_object_count() {
+            return large_objects.size();
+        }
+    
+        /**
+         * Selects the placement policy used by find_free().
+         * @param policy FIRST_FIT, BEST_FIT or NEXT_FIT.
+         */
+        void set_policy(alloc_policy_t policy);
+    
+        /**
+         * @return The current placement policy.
+         */
+        alloc_policy_t get_policy() {
+            return policy;
+        }
+    
         /**
          * Finds a free block large enough to hold `size` bytes.
          * @param size The size needed.
@@ -86,6 +393,68 @@ class Heap {
          * @param free_block Pointer to the block being freed.
          */
         void coalesce(node_t *free_block);
+
+    private:
+        char *heap_base;   // Start of the heap mapping (head moves as blocks are split)
+        size_t map_length; // Length of the heap mapping (the whole reservation of a growable heap)
+        size_t committed;  // Bytes of a growable heap's reservation that are readable and writable
+
+        /**
+         * Maps the heap region according to `pages`. Huge page modes round the
+         * mapping up to a multiple of HUGE_PAGE_SIZE, align it to one, and grow
+         * `heap_size` to cover the rounding. Either huge page mode falls back
+         * to normal pages when the kernel refuses. When `max_heap_size` is
+         * larger than `heap_size`, normal pages are used and the whole
+         * maximum is reserved inaccessible, with only the first `heap_size`
+         * bytes committed; both sizes are then trimmed so the tail sentinel
+         * sits where a block could start, letting grow() free the space
+         * after it.
+         * @return Start of the mapping, or NULL if mmap fails.
+         */
+        char *map_heap();
+
+        alloc_policy_t policy; // Placement policy used by find_free()
+
+        /**
+         * Next-fit roving pointer: the free block after which the next search
+         * starts (NULL for the head). coalesce() moves it onto the block that
+         * absorbs it, so it always names a block on the free list.
+         */
+        node_t *rover;
+
+        /**
+         * Slab pages: all of them ordered by address for pointer lookups,
+         * and per size class for allocation.
+         */
+        set<slab_t *> slabs;
+        map<size_t, vector<slab_t *>> size_classes;
+
+        /**
+         * Best-fit indexes over the free list, only maintained under BEST_FIT:
+         * blocks ordered by (size, address) for the lookup, and by address to
+         * find a block's predecessor in the singly linked free list.
+         */
+        set<pair<size_t, node_t *>> free_by_size;
+        set<node_t *> free_by_addr;
+
+        /**
+         * Free space counters, maintained under every policy by the same
+         * hooks as the best-fit indexes: total free bytes, number of free
+         * blocks, and how many free blocks there are of each size (its last
+         * key is the largest free block).
+         */
+        size_t free_bytes;
+        size_t free_blocks;
+        map<size_t, size_t> free_sizes;
+
+        void index_add(node_t *block);
+        void index_remove(node_t *block);
+        void index_rebuild();
+
+        /**
+         * Large objects sorted by base address, so membership is a binary search.
+         */
+        vector<large_object> large_objects;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#ifndef __PROFILER_H
+#define __PROFILER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <ostream>
+
+using namespace std;
+
+#define PROFILE_SAMPLE_RATE (512 * 1024) // Default mean bytes between samples, as in tcmalloc
+#define PROFILE_MAX_FRAMES 32            // Deepest backtrace kept per sample
+
+/**
+ * What the samples taken at one allocation site (one distinct backtrace)
+ * add up to. Counts are of samples, not of allocations; pprof scales them
+ * back up using the sample rate.
+ */
+typedef struct profile_site {
+    vector<void*> frames;  // Return addresses, innermost first.
+    size_t alloc_objects;  // Samples taken here.
+    size_t alloc_bytes;    // Their bytes.
+    size_t live_objects;   // Samples not freed yet.
+    size_t live_bytes;
+    size_t survived;       // Samples that lived through at least one collection.
+    size_t freed_young;    // Samples freed by the first collection they saw.
+} profile_site;
+
+/**
+ * Sampling allocation profiler. A countdown of bytes is decremented by every
+ * allocation; when it runs out, the allocation is sampled: its backtrace is
+ * captured and it is followed until freed. Intervals between samples are
+ * drawn from an exponential distribution with the sample rate as mean, the
+ * scheme pprof's heap_v2 format assumes when it unsamples.
+ */
+class AllocationProfiler {
+    public:
+        /**
+         * @param sample_rate Mean bytes between samples; 1 samples every allocation.
+         */
+        AllocationProfiler(size_t sample_rate);
+
+        /**
+         * Called for every allocation: a subtraction unless it is sampled.
+         * @param ptr The new object (NULL allocations are ignored).
+         * @param size Bytes requested.
+         */
+        void allocated(void *ptr, size_t size) {
+            bytes_until_sample -= (int64_t)size;
+            if (bytes_until_sample < 0 && ptr) {
+                sample(ptr, size);
+            }
+        }
+
+        /**
+         * An object was freed explicitly.
+         * @param ptr The object.
+         */
+        void freed(void *ptr);
+
+        /**
+         * A collection ran: its victims are freed and every surviving
+         * sample ages by one collection.
+         * @param deleted Objects the collection freed.
+         */
+        void collected(const list<void*> &deleted);
+
+        /**
+         * Writes the profile in the legacy text heap format read by pprof
+         * (`pprof <binary> <file>`), with the process mappings appended so
+         * that the addresses can be symbolized.
+         * @param path File to create.
+         * @return True if the file was written.
+         */
+        bool write_pprof(const char *path) const;
+
+        /**
+         * Writes a readable summary: the `top` sites by sampled bytes, with
+         * their live bytes, survival and symbolized frames.
+         * @param out Stream to write to.
+         * @param top Number of sites.
+         */
+        void report(ostream &out, size_t top) const;
+
+        /**
+         * @return Every site sampled so far, in order of first sample.
+         */
+        const vector<profile_site> &sites() const {
+            return site_list;
+        }
+
+        /**
+         * @return Mean bytes between samples.
+         */
+        size_t rate() const {
+            return sample_rate;
+        }
+
+    private:
+        typedef struct sampled_object {
+            size_t site;        // Index in site_list
+            size_t size;
+            size_t collections; // Collections survived
+        } sampled_object;
+
+        void sample(void *ptr, size_t size);
+        void release(const sampled_object &object);
+        int64_t next_interval();
+
+        size_t sample_rate;
+        int64_t bytes_until_sample;
+        uint64_t random_state;  // xorshift64 state for the intervals
+        vector<profile_site> site_list;
+        map<vector<void*>, size_t> site_index; // Backtrace to index in site_list
+        unordered_map<void*, sampled_object> sampled; // Live samples by address
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef __RECORDER_H
+#define __RECORDER_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+class GarbageCollector;
+class Heap;
+
+#define RECORD_MAGIC "GCREC001"   // First 8 bytes of an allocation trace
+#define RECORD_BUFFER (64 * 1024) // stdio buffer of a trace being written
+
+/**
+ * Operations of an allocation trace, matching what the simulator exposes.
+ * Each is one opcode byte followed by LEB128 varint operands. Objects are
+ * named by allocation order: the n-th OP_ALLOC (or OP_ALLOC_ATOMIC, or
+ * OP_ALLOC_ALIGNED) creates object n, whether or not it succeeded.
+ */
+typedef enum {
+    OP_ALLOC = 1, // size
+    OP_REF,       // object: add a root
+    OP_NESTED,    // source object, target object
+    OP_DELREF,    // object: drop a root
+    OP_FREE,      // object: explicit free
+    OP_RC,        // rc_collect()
+    OP_MS,        // ms_collect()
+    OP_NESTED_FIELD, // source object, target object, field index (field > 0)
+    OP_ALLOC_ATOMIC, // size: malloc_atomic()
+    OP_ALLOC_ALIGNED, // size, alignment: aligned_malloc()
+    OP_MS_PACED      // ms_collect() started by the pacer inside an allocation
+} record_op_t;
+
+/**
+ * Writes the operations performed on a GarbageCollector to a trace file.
+ * The collector calls it from its public entry points while recording is
+ * on (see GarbageCollector::start_recording()).
+ */
+class AllocationRecorder {
+    public:
+        AllocationRecorder() {
+            file = NULL;
+            next_id = 0;
+            ops = 0;
+        }
+
+        ~AllocationRecorder() {
+            close();
+        }
+
+        AllocationRecorder(const AllocationRecorder &) = delete;
+        AllocationRecorder &operator=(const AllocationRecorder &) = delete;
+
+        /**
+         * Creates the trace file and writes its header.
+         * @param path File to create.
+         * @return True on success.
+         */
+        bool open(const char *path);
+
+        /**
+         * Flushes and closes the trace file.
+         * @return True if everything was written.
+         */
+        bool close();
+
+        /**
+         * Records an allocation request.
+         * @param ptr The object, or NULL if the allocation failed.
+         * @param size Bytes requested.
+         * @param op OP_ALLOC, OP_ALLOC_ATOMIC or OP_ALLOC_ALIGNED.
+         * @param align Alignment requested, for OP_ALLOC_ALIGNED.
+         */
+        void alloc(void *ptr, size_t size, record_op_t op = OP_ALLOC, size_t align = 0);
+
+        /**
+         * Records an operation on one object; unknown pointers are skipped.
+         * @param op OP_REF, OP_DELREF or OP_FREE.
+         * @param ptr The object.
+         */
+        void object_op(record_op_t op, void *ptr);
+
+        /**
+         * Records a nested reference between two known objects.
+         * @param src The object written to.
+         * @param dest The object referenced.
+         * @param field Field of `src` written; 0 is recorded as OP_NESTED.
+         */
+        void nested(void *src, void *dest, size_t field);
+
+        /**
+         * Records a collection and forgets the objects it freed, so their
+         * addresses can be given to new objects.
+         * @param op OP_RC, OP_MS or OP_MS_PACED.
+         * @param deleted Objects freed by the collection.
+         */
+        void collect(record_op_t op, const list<void*> &deleted);
+
+        /**
+         * @return Number of operations written so far.
+         */
+        size_t operations() const {
+            return ops;
+        }
+
+    private:
+        void put_varint(uint64_t value);
+
+        FILE *file;
+        uint64_t next_id; // Id of the next allocation
+        size_t ops;       // Operations written
+        unordered_map<void*, uint64_t> ids; // Live objects by address
+};
+
+/**
+ * What replaying a trace measured.
+ */
+typedef struct replay_result {
+    size_t operations;         // Operations executed.
+    size_t allocations;        // OP_ALLOC, OP_ALLOC_ATOMIC and OP_ALLOC_ALIGNED operations.
+    size_t failed_allocations; // Allocations that returned NULL under this configuration.
+    size_t collections;        // Collections run, the replaying pacer's included.
+    size_t skipped_collections; // OP_MS_PACED operations left to the replaying pacer.
+    double seconds;            // Wall time of the replay.
+    double gc_seconds;         // Part of it spent in collections.
+    size_t min_available;      // Least free memory seen after an operation.
+    double max_fragmentation;  // Worst Heap::fragmentation() seen after a collection.
+    double end_fragmentation;  // Heap::fragmentation() after the last operation.
+    long peak_rss_kb;          // Process peak resident set size (getrusage).
+} replay_result;
+
+/**
+ * Re-executes a trace against a collector and heap, configured however the
+ * caller likes (policy, size classes, page mode, pacer, ...). Operations
+ * naming an object whose allocation failed, or which was already freed, are
+ * skipped. Collections the recording's pacer ran are replayed only if `gc`
+ * has no pacer of its own. The collector's collection hook is replaced.
+ * @param path Trace written by AllocationRecorder.
+ * @param gc Collector to drive.
+ * @param heap Heap to allocate from.
+ * @param result Output: measurements.
+ * @return True if the whole trace was read, false if it is missing or malformed.
+ */
+bool replay_trace(const char *path, GarbageCollector &gc, Heap &heap, replay_result &result);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __REGION_H
+#define __REGION_H
+#include <stdlib.h>
+#include <stdint.h>
+
+class Heap;
+class GarbageCollector;
+
+#define REGION_ALIGN 16 // Alignment of every region allocation
+
+/**
+ * Bump-pointer arena carved out of a Heap as one block and released all at
+ * once. Objects allocated here are not tracked individually by the collector
+ * (no allocation or reference count entries), but the used part of the
+ * region is scanned as a root source during mark(), so any collected object
+ * a temporary points to stays alive while the region does.
+ */
+class Region {
+    public:
+        /**
+         * Reserves `capacity` bytes from `heap` and registers the region with `gc`.
+         * The block always comes from the free list, never the large object
+         * space. If the heap cannot supply it, the region is empty and every
+         * allocate() fails.
+         * @param gc Collector whose mark phase should scan this region.
+         * @param heap Heap to carve the region from.
+         * @param capacity Number of bytes to reserve.
+         */
+        Region(GarbageCollector &gc, Heap *heap, size_t capacity);
+
+        /**
+         * Releases the region if release() was not called already.
+         */
+        ~Region();
+
+        Region(const Region &) = delete;
+        Region &operator=(const Region &) = delete;
+
+        /**
+         * Bump-allocates `size` bytes at the next 16-byte aligned address.
+         * @param size Number of bytes to allocate.
+         * @return Pointer to the memory, or NULL if the region is exhausted.
+         */
+        void *allocate(size_t size);
+
+        /**
+         * Returns the whole region to the heap and unregisters it from the
+         * collector. Every pointer into the region becomes invalid.
+         */
+        void release();
+
+        /**
+         * @return First aligned byte of the region (NULL if it holds no memory).
+         */
+        char *begin() const {
+            return (char *)(((uintptr_t)base + REGION_ALIGN - 1) & ~(uintptr_t)(REGION_ALIGN - 1));
+        }
+
+        /**
+         * @return One past the last allocated byte.
+         */
+        char *end() const { return cursor; }
+
+        /**
+         * @return Number of bytes still available.
+         */
+        size_t remaining() const { return limit - cursor; }
+
+    private:
+        GarbageCollector &gc;
+        Heap *heap;
+        char *base;   // Start of the carved block.
+        char *cursor; // Next free byte.
+        char *limit;  // End of the carved block.
+};
+
+#endif
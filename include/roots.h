@@ -0,0 +1,133 @@
+#ifndef __ROOTS_H
+#define __ROOTS_H
+#include <stdlib.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+class GarbageCollector;
+
+#define ROOT_CHUNK_SLOTS 256 // Root slots per chunk of the root table
+#define NO_SLOT ((size_t)-1)  // End of a slot chain
+
+/**
+ * Table of root slots, stored as a list of fixed-size chunks so that slot
+ * addresses never move. A slot is identified by its index. Pushing a root
+ * bumps `top` or reuses a released slot, releasing one clears it, and a
+ * whole range above a saved top can be dropped at once (see HandleScope).
+ * Empty slots hold NULL and are skipped by the mark phase. The slots holding
+ * the same pointer are chained, newest first, so finding or releasing them
+ * never walks the table.
+ */
+class RootTable {
+    public:
+        RootTable() {
+            top = 0;
+            scope_base = 0;
+        }
+
+        ~RootTable();
+
+        RootTable(const RootTable &) = delete;
+        RootTable &operator=(const RootTable &) = delete;
+
+        /**
+         * Stores a pointer in a free slot.
+         * @param ptr Pointer to store.
+         * @return Index of the slot now holding `ptr`.
+         */
+        size_t push(void *ptr);
+
+        /**
+         * Clears a slot and makes it available for reuse. Releasing a slot
+         * twice would hand it out twice, so the slot must be in use.
+         * @param slot Index of an occupied slot below size().
+         */
+        void release(size_t slot);
+
+        /**
+         * Finds the most recently pushed slot holding `ptr`.
+         * @param ptr Pointer to look for.
+         * @param slot Output: index of the slot, if found.
+         * @return True if a slot holds `ptr`.
+         */
+        bool find(void *ptr, size_t *slot) const;
+
+        /**
+         * Clears every slot holding `ptr`.
+         * @param ptr Pointer whose roots to drop.
+         * @return Number of slots cleared.
+         */
+        size_t release_all(void *ptr);
+
+        /**
+         * Drops every slot at or above `new_top` in one step.
+         * @param new_top The top to return to, as saved by a HandleScope.
+         */
+        void truncate(size_t new_top);
+
+        /**
+         * @param slot Index of a slot below size().
+         * @return The pointer stored in the slot (NULL if it is empty).
+         */
+        void *get(size_t slot) const {
+            return chunks[slot / ROOT_CHUNK_SLOTS][slot % ROOT_CHUNK_SLOTS];
+        }
+
+        /**
+         * @return Number of slots in use or released below the current top.
+         */
+        size_t size() const {
+            return top;
+        }
+
+        /**
+         * Lowest slot index the innermost open HandleScope may hand out
+         * again from the free list. Slots below it belong to outer scopes.
+         */
+        size_t scope_base;
+
+    private:
+        // Chain links of a slot holding a non-NULL pointer
+        typedef struct slot_link {
+            size_t newer; // Slot pushed next with the same pointer, or NO_SLOT
+            size_t older; // Slot pushed before with the same pointer, or NO_SLOT
+        } slot_link;
+
+        vector<void **> chunks;     // Fixed-size slot arrays, never moved.
+        vector<slot_link *> links;  // Chain links, one array per chunk.
+        vector<size_t> free_slots;  // Released slots below `top`.
+        size_t top;                 // One past the highest slot handed out.
+        unordered_map<void *, size_t> newest; // Head of each pointer's slot chain.
+
+        slot_link &link(size_t slot) {
+            return links[slot / ROOT_CHUNK_SLOTS][slot % ROOT_CHUNK_SLOTS];
+        }
+
+        /**
+         * Takes a slot out of its pointer's chain.
+         * @param ptr Pointer held by the slot.
+         * @param slot Index of the slot.
+         */
+        void unlink(void *ptr, size_t slot);
+};
+
+/**
+ * Releases, on destruction, every root slot pushed on its collector while it
+ * was the innermost scope (like a V8 HandleScope). Scopes must nest.
+ */
+class HandleScope {
+    public:
+        HandleScope(GarbageCollector &gc);
+        ~HandleScope();
+
+        HandleScope(const HandleScope &) = delete;
+        HandleScope &operator=(const HandleScope &) = delete;
+
+    private:
+        GarbageCollector &gc;
+        size_t saved_top;   // Root table top when the scope was opened.
+        size_t saved_base;  // Enclosing scope's base.
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <gc_stats.h>
+
+using namespace std;
+
+#define SNAPSHOT_MAGIC "GCSNAP01"            // First 8 bytes of a heap snapshot
+#define SNAPSHOT_UNREACHABLE ((size_t)-1)    // Dominator of a block no root reaches
+
+/**
+ * Records of a heap snapshot, each one tag byte followed by LEB128 varint
+ * fields. Blocks are written in address order and numbered from 0; edges
+ * and roots name blocks by that number.
+ */
+typedef enum {
+    SNAP_BLOCK = 1, // address delta from the previous block, size, flags, edge count, targets...
+    SNAP_ROOT,      // root kind, block
+    SNAP_END        // block count, root count
+} snapshot_tag_t;
+
+// Bits of a block's flags, copied from its allocation header
+#define SNAP_FLAG_MARKED       0x01 // Marked by the last mark phase
+#define SNAP_FLAG_POINTER_FREE 0x02 // Never scanned for pointers
+#define SNAP_FLAG_LARGE        0x04 // In the large object space
+#define SNAP_FLAG_SLAB         0x08 // In a slab slot
+#define SNAP_FLAG_AGE_SHIFT    4    // Collections survived, in the top four bits
+
+/**
+ * Where a root came from.
+ */
+typedef enum {
+    ROOT_SLOT = 0, // A root table slot (add_reference(), gc_ptr, HandleScope)
+    ROOT_REGION    // A word in a live Region
+} snapshot_root_t;
+
+typedef struct snapshot_block {
+    uintptr_t address;  // Payload address.
+    size_t size;        // Payload bytes.
+    uint8_t flags;      // SNAP_FLAG_* bits.
+    size_t first_edge;  // Its targets are edges[first_edge, next block's first_edge).
+} snapshot_block;
+
+typedef struct snapshot_root {
+    snapshot_root_t kind;
+    size_t block;
+} snapshot_root;
+
+/**
+ * A snapshot read back into memory. Edges are stored once, in block order.
+ */
+typedef struct heap_snapshot {
+    vector<snapshot_block> blocks;
+    vector<size_t> edges;          // Target block of each edge.
+    vector<snapshot_root> roots;
+
+    /**
+     * @return Index one past the last edge of block `i`.
+     */
+    size_t edges_end(size_t i) const {
+        return i + 1 < blocks.size() ? blocks[i + 1].first_edge : edges.size();
+    }
+} heap_snapshot;
+
+/**
+ * Reads a snapshot written by GarbageCollector::dump_snapshot().
+ * @param path Snapshot file.
+ * @param snapshot Output: the snapshot.
+ * @return False if the file is missing, truncated or malformed.
+ */
+bool read_snapshot(const char *path, heap_snapshot &snapshot);
+
+/**
+ * What the analyzer derived from a snapshot.
+ */
+typedef struct snapshot_analysis {
+    /**
+     * Immediate dominator of each block: another block, blocks.size() when
+     * only the root set itself dominates it, or SNAPSHOT_UNREACHABLE.
+     */
+    vector<size_t> idom;
+    vector<size_t> retained; // Bytes freed if the block became unreachable.
+
+    size_t reachable_blocks;
+    size_t reachable_bytes;
+    size_t unreachable_blocks; // Garbage waiting for the next collection.
+    size_t unreachable_bytes;
+
+    // Blocks and bytes per power-of-two size, bucketed like GcHistogram
+    size_t size_blocks[GC_HISTOGRAM_BUCKETS];
+    size_t size_bytes[GC_HISTOGRAM_BUCKETS];
+} snapshot_analysis;
+
+/**
+ * Builds the dominator tree of the object graph (Lengauer-Tarjan, from a
+ * virtual node standing for the whole root set) and the retained size of
+ * every block, i.e. the total size of its dominator subtree.
+ * @param snapshot The snapshot.
+ * @param analysis Output: dominators, retained sizes and size histograms.
+ */
+void analyze_snapshot(const heap_snapshot &snapshot, snapshot_analysis &analysis);
+
+/**
+ * @param analysis An analysis.
+ * @param count How many blocks to return.
+ * @return The `count` blocks with the largest retained sizes, largest first.
+ */
+vector<size_t> top_retainers(const snapshot_analysis &analysis, size_t count);
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef __WORKLOAD_H
+#define __WORKLOAD_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <ostream>
+
+using namespace std;
+class GarbageCollector;
+class Heap;
+
+/**
+ * Object graph shapes the generator can build.
+ */
+typedef enum {
+    SHAPE_LIST,      // Singly linked lists through field 0
+    SHAPE_TREE,      // Complete binary trees, children in fields 0 and 1
+    SHAPE_DAG,       // A chain plus random forward edges, so no cycles
+    SHAPE_CYCLES,    // Rings plus random edges within each cluster
+    SHAPE_POWER_LAW  // Zipf-distributed out-degree with preferential targets
+} workload_shape_t;
+
+/**
+ * Parameters of a synthetic workload. The objects are split into components
+ * of `component` objects, each reachable from its first object, which is
+ * the only one left rooted. A `survival` fraction of the components keeps
+ * its root; the rest becomes garbage for the next collection.
+ */
+typedef struct workload_params {
+    workload_shape_t shape = SHAPE_LIST;
+    size_t objects = 1024;      // Total number of objects.
+    size_t object_size = 32;    // Bytes per object, raised to fit its pointer fields.
+    size_t max_fanout = 4;      // Pointer fields per object (dag, cycles, power law).
+    size_t component = 0;       // Objects per component; 0 for a single component.
+    double survival = 1.0;      // Fraction of components left rooted, in [0, 1].
+    double power_law_alpha = 2.0; // Exponent of the power-law out-degree.
+    uint32_t seed = 42;         // Seed of the random choices; equal seeds build equal graphs.
+} workload_params;
+
+/**
+ * What the generator built.
+ */
+typedef struct workload_result {
+    size_t objects;    // Objects requested.
+    size_t failed;     // Allocations that failed; their edges are skipped.
+    size_t edges;      // Nested references written.
+    size_t components; // Components built.
+    size_t roots;      // Components left rooted.
+    size_t survivors;  // Objects reachable from those roots.
+} workload_result;
+
+/**
+ * Receives the operations of a workload. Objects are named by allocation
+ * order, and every object starts rooted, as GarbageCollector::malloc()
+ * leaves it.
+ */
+class WorkloadSink {
+    public:
+        virtual ~WorkloadSink() {}
+
+        /**
+         * Allocates object `id`.
+         * @return False if the allocation failed.
+         */
+        virtual bool alloc(size_t id, size_t size) = 0;
+
+        /**
+         * Stores a reference to `dest` in pointer field `field` of `src`.
+         */
+        virtual void link(size_t src, size_t dest, size_t field) = 0;
+
+        /**
+         * Drops the root an object was allocated with.
+         */
+        virtual void unroot(size_t id) = 0;
+};
+
+/**
+ * Builds the workload on a collector: malloc(), add_nested_reference()
+ * and release_reference(). Objects are zeroed so that only the generated
+ * edges keep anything alive.
+ */
+class GcWorkloadSink : public WorkloadSink {
+    public:
+        GcWorkloadSink(GarbageCollector &gc, Heap *heap) : gc(gc), heap(heap) {}
+
+        bool alloc(size_t id, size_t size) override;
+        void link(size_t src, size_t dest, size_t field) override;
+        void unroot(size_t id) override;
+
+        /**
+         * Releases the roots still held, so the whole workload is garbage.
+         */
+        void release_roots();
+
+        vector<void*> objects; // Objects by id, NULL where allocation failed.
+
+    private:
+        GarbageCollector &gc;
+        Heap *heap;
+        vector<size_t> slots;  // Root slot of each object, (size_t)-1 once released.
+};
+
+/**
+ * Writes the workload as a simulator script (`alloc`, `ref`, `delref`),
+ * naming object n `o<n>`, for marksweep_app --batch.
+ */
+class ScriptWorkloadSink : public WorkloadSink {
+    public:
+        ScriptWorkloadSink(ostream &out) : out(out) {}
+
+        bool alloc(size_t id, size_t size) override;
+        void link(size_t src, size_t dest, size_t field) override;
+        void unroot(size_t id) override;
+
+    private:
+        ostream &out;
+};
+
+/**
+ * Generates a workload. Each component is allocated, linked, then all but
+ * its first object are unrooted; once every component exists, the roots of
+ * the components that do not survive are dropped.
+ * @param params The shape and size of the graph.
+ * @param sink Where the operations go.
+ * @return Counts of what was built, including the expected survivors.
+ */
+workload_result generate_workload(const workload_params &params, WorkloadSink &sink);
+
+/**
+ * @param name "list", "tree", "dag", "cycles" or "power-law".
+ * @param shape Output: the shape.
+ * @return False for an unknown name.
+ */
+bool parse_workload_shape(const char *name, workload_shape_t *shape);
+
+/**
+ * @return The name parse_workload_shape() accepts for a shape.
+ */
+const char *workload_shape_name(workload_shape_t shape);
+
+#endif
@@ -1,21 +1,78 @@
 #include <assert.h>
+#include <unistd.h>
 #include <gc.h>
 #include <heap.h>
+#include <region.h>
+#include <gc_trace.h>
+#include <recorder.h>
+#include <profiler.h>
 #include <iostream>
+#include <algorithm>
 
 /**
  * Allocates memory from the heap and registers it with the garbage collector.
  *
  * @param size The number of bytes to allocate.
  * @param heap Pointer to the heap object used for allocation.
+ * @param slot Optional output for the root slot of the new object.
  * @return A pointer to the allocated memory block, or NULL if allocation fails.
  */
-void* GarbageCollector::malloc(size_t size, Heap *heap) {
-    void *ptr = heap->my_malloc(size);
+void* GarbageCollector::malloc(size_t size, Heap *heap, size_t *slot) {
+    return allocate(size, heap, slot, false);
+}
+
+/**
+ * Allocates a block that the mark phase will not scan for pointers.
+ *
+ * @param size The number of bytes to allocate.
+ * @param heap Pointer to the heap object used for allocation.
+ * @return A pointer to the allocated memory block, or NULL if allocation fails.
+ */
+void* GarbageCollector::malloc_atomic(size_t size, Heap *heap) {
+    return allocate(size, heap, NULL, true);
+}
+
+/**
+ * Allocates from a slab or the heap, collecting or growing the heap first
+ * if the pacer is on, then registers and records the object.
+ *
+ * @param size The number of bytes to allocate.
+ * @param heap Pointer to the heap object used for allocation.
+ * @param slot Optional output for the root slot of the new object.
+ * @param pointer_free Whether the object is never scanned (malloc_atomic()).
+ * @return A pointer to the allocated memory block, or NULL if allocation fails.
+ */
+void* GarbageCollector::allocate(size_t size, Heap *heap, size_t *slot, bool pointer_free) {
+    record_op_t op = pointer_free ? OP_ALLOC_ATOMIC : OP_ALLOC;
+    pace(size, heap);
+    void *ptr = NULL;
+    for (int attempt = 0; ptr == NULL; attempt++) {
+        // Slab objects are found through their slab, not the allocations map
+        ptr = heap->slab_malloc(size);
+        if (ptr) {
+            GC_TRACE_INSTANT(TRACE_MALLOC, size, (uintptr_t)ptr);
+            ((allocation *)((char *)ptr - sizeof(allocation)))->pointer_free = pointer_free;
+            if (recorder) recorder->alloc(ptr, size, op);
+            if (profiler) profiler->allocated(ptr, size);
+            size_t root = conservative_roots ? (size_t)-1 : push_root(ptr);
+            if (slot) *slot = root;
+            return ptr;
+        }
+
+        ptr = heap->my_malloc(size);
+        size_t bytes = size >= heap->large_threshold ? 0 : Heap::align_size(size) + sizeof(allocation);
+        if (ptr == NULL && !make_room(bytes, heap, attempt)) {
+            break;
+        }
+    }
+    if (recorder) recorder->alloc(ptr, size, op);
 
     if (ptr) {
-        allocations[ptr] = (allocation *)((char*)ptr - sizeof(allocation));
-        add_reference(ptr);
+        GC_TRACE_INSTANT(TRACE_MALLOC, size, (uintptr_t)ptr);
+        ((allocation *)((char *)ptr - sizeof(allocation)))->pointer_free = pointer_free;
+        if (profiler) profiler->allocated(ptr, size);
+        size_t root = track(ptr);
+        if (slot) *slot = root;
     } else {
         return NULL;
     }
@@ -24,55 +81,288 @@ void* GarbageCollector::malloc(size_t size, Heap *heap) {
 }
 
 /**
- * Recursively marks reachable memory blocks by scanning for pointers within the given block.
+ * Allocates an aligned block from the heap and registers it with the garbage collector.
  *
- * @param ptr Pointer to the memory block to scan.
+ * @param size The number of bytes to allocate.
+ * @param align The required alignment, a power of two.
+ * @param heap Pointer to the heap object used for allocation.
+ * @return A pointer to the allocated memory block, or NULL if allocation fails.
  */
-void GarbageCollector::walk_block(void* ptr) {
-    if (!ptr) return;
+void* GarbageCollector::aligned_malloc(size_t size, size_t align, Heap *heap) {
+    pace(size, heap);
+    void *ptr = heap->my_aligned_malloc(size, align);
+    bool large = size >= heap->large_threshold && align <= (size_t)sysconf(_SC_PAGESIZE);
+    for (int attempt = 0; ptr == NULL; attempt++) {
+        if (!make_room(large ? 0 : Heap::align_size(size + align) + sizeof(allocation), heap, attempt)) break;
+        ptr = heap->my_aligned_malloc(size, align);
+    }
+    if (recorder) recorder->alloc(ptr, size, OP_ALLOC_ALIGNED, align);
+    if (ptr) {
+        GC_TRACE_INSTANT(TRACE_MALLOC, size, (uintptr_t)ptr);
+        if (profiler) profiler->allocated(ptr, size);
+        track(ptr);
+    }
+    return ptr;
+}
 
-    allocation *alloc = (allocation *)(((char *)ptr) - sizeof(allocation));
-    size_t size = alloc->size;
+/**
+ * Registers a freshly allocated block and roots it unless conservative
+ * scanning is responsible for finding it.
+ *
+ * @param ptr The block to register.
+ * @return The root slot pushed for it, or (size_t)-1.
+ */
+size_t GarbageCollector::track(void *ptr) {
+    allocations[ptr] = (allocation *)((char*)ptr - sizeof(allocation));
+    if (conservative_roots) {
+        return (size_t)-1;
+    }
+    return push_root(ptr);
+}
 
-    if (alloc->marked) {
-        return;
+/**
+ * Allocates a batch of equal-sized objects and registers them. The heap
+ * returns them in address order, so each map insert is hinted with the
+ * position of the previous one.
+ *
+ * @param count Number of objects to allocate.
+ * @param size Size of each object in bytes.
+ * @param heap Pointer to the heap object used for allocation.
+ * @param out Output array for the allocated pointers.
+ * @return Number of objects allocated.
+ */
+size_t GarbageCollector::malloc_n(size_t count, size_t size, Heap *heap, void **out) {
+    pace(count * size, heap);
+    size_t n = heap->my_malloc_n(count, size, out);
+    for (int attempt = 0; n < count && gc_percent >= 0; attempt++) {
+        // The partial batch is not registered yet, so a collection could hand
+        // its blocks out again: give it back and ask for the whole batch anew
+        heap->free_many(out, n);
+        bool retry = make_room(count * (Heap::align_size(size) + sizeof(allocation)), heap, attempt);
+        n = heap->my_malloc_n(count, size, out);
+        if (!retry) break;
+    }
+    if (recorder) {
+        for (size_t i = 0; i < count; i++) {
+            recorder->alloc(i < n ? out[i] : NULL, size);
+        }
+    }
+    if (n == 0) return 0;
+    GC_TRACE_INSTANT(TRACE_MALLOC, n * size, (uintptr_t)out[0]);
+    if (profiler) {
+        for (size_t i = 0; i < n; i++) {
+            profiler->allocated(out[i], size);
+        }
+    }
+
+    auto alloc_hint = allocations.lower_bound(out[0]);
+    auto rc_hint = reference_count.lower_bound(out[0]);
+    for (size_t i = 0; i < n; i++) {
+        void *ptr = out[i];
+        alloc_hint = allocations.emplace_hint(alloc_hint, ptr,
+                                              (allocation *)((char *)ptr - sizeof(allocation)));
+        ++alloc_hint;
+        if (!conservative_roots) {
+            rc_hint = reference_count.emplace_hint(rc_hint, ptr, 0);
+            rc_hint->second++;
+            ++rc_hint;
+            root_set.push(ptr);
+        }
+    }
+    return n;
+}
+
+/**
+ * Marks an object if `ptr` is the start of one that is not yet marked.
+ * Blocks tracked in `allocations` keep their mark bit in the header; slab
+ * objects keep it in their slab's mark bitmap.
+ *
+ * @param ptr Candidate object pointer.
+ * @param heap Heap whose slabs are consulted.
+ * @return True if the object was newly marked and still needs scanning.
+ */
+bool GarbageCollector::mark_object(void *ptr, Heap *heap) {
+    auto alloc = allocations.find(ptr);
+    if (alloc != allocations.end()) {
+        if (alloc->second->marked) return false;
+        alloc->second->marked = true;
+        return true;
     }
-    alloc->marked = true;
 
-    uintptr_t* scan = reinterpret_cast<uintptr_t*>(ptr);
-    uintptr_t* end = reinterpret_cast<uintptr_t*>(reinterpret_cast<char*>(ptr) + size);
+    unsigned slot;
+    Heap::slab_t *slab = heap->slab_find(ptr, &slot);
+    if (!slab || Heap::slab_payload(slab, slot) != ptr) return false;
+    uint64_t bit = 1ULL << slot;
+    if (slab->marked & bit) return false;
+    slab->marked |= bit;
+    return true;
+}
+
+/**
+ * Marks every block reachable from the marked blocks on the mark stack,
+ * scanning each block's words for pointers to other blocks. Uses an explicit
+ * mark stack rather than recursion so that long chains cannot overflow the
+ * C stack.
+ *
+ * @param heap Heap whose slabs are consulted.
+ */
+void GarbageCollector::drain_mark_stack(Heap *heap) {
+    while (!mark_stack.empty()) {
+        void *block = mark_stack.back();
+        mark_stack.pop_back();
+
+        allocation *alloc = (allocation *)(((char *)block) - sizeof(allocation));
+        cycle.objects_marked++;
+        cycle.bytes_marked += alloc->size;
+        if (alloc->pointer_free) continue;
 
-    while (scan < end) {
-        void* maybe_ptr = reinterpret_cast<void*>(*scan);
-        if (allocations.find(maybe_ptr) != allocations.end()) {
-            allocation* found_block = allocations[maybe_ptr];
-            if (!found_block->marked) {
-                walk_block(maybe_ptr);
+        uintptr_t* scan = reinterpret_cast<uintptr_t*>(block);
+        uintptr_t* end = reinterpret_cast<uintptr_t*>(reinterpret_cast<char*>(block) + alloc->size);
+        cycle.words_scanned += end - scan;
+
+        while (scan < end) {
+            void* maybe_ptr = reinterpret_cast<void*>(*scan);
+            if (mark_object(maybe_ptr, heap)) {
+                mark_stack.push_back(maybe_ptr);
             }
+            ++scan;
         }
-        ++scan;
     }
 }
 
 /**
  * Initiates the mark phase of the garbage collection process.
- * Marks all reachable memory blocks starting from the root set.
+ * Marks all reachable memory blocks starting from the root set. Every
+ * root source only pushes the objects it reaches onto the mark stack,
+ * which is drained afterwards, so root scanning and tracing are timed
+ * separately.
+ *
+ * @param heap Heap whose slab objects are marked alongside `allocations`.
  */
-void GarbageCollector::mark() {
+void GarbageCollector::mark(Heap *heap) {
+    uint64_t start = gc_now_ns();
+    GC_TRACE_BEGIN(TRACE_CLEAR);
 
     // Clear all markings
     for (auto alloc = allocations.begin(); alloc != allocations.end(); alloc++) {
         alloc->second->marked = false;
     }
+    heap->slab_clear_marks();
+    uint64_t cleared = gc_now_ns();
+    GC_TRACE_END(TRACE_CLEAR);
+    GC_TRACE_BEGIN(TRACE_ROOT_SCAN);
 
     // Traverse the root set to identify reachable objects
-    for (void* root : root_set) {
-        auto alloc = allocations.find(root);
-        if (alloc != allocations.end()) {
-            if (!alloc->second->marked) {
-                walk_block(alloc->first); // Traverse the block's memory to identify additional references
+    for (size_t slot = 0; slot < root_set.size(); slot++) {
+        void* root = root_set.get(slot);
+        if (root && mark_object(root, heap)) {
+            mark_stack.push_back(root);
+        }
+    }
+
+    // Region temporaries may point at collected objects
+    for (Region *region : regions) {
+        uintptr_t *scan = (uintptr_t *)region->begin();
+        uintptr_t *end = (uintptr_t *)region->end();
+        for (; scan < end; ++scan) {
+            mark_conservative(*scan, heap);
+        }
+    }
+
+    if (conservative_roots) {
+        scan_thread_stacks(heap);
+    }
+    uint64_t scanned = gc_now_ns();
+    GC_TRACE_END(TRACE_ROOT_SCAN);
+
+    // Traverse the blocks' memory to identify additional references
+    GC_TRACE_BEGIN(TRACE_MARK);
+    drain_mark_stack(heap);
+    GC_TRACE_END(TRACE_MARK, cycle.objects_marked, cycle.bytes_marked);
+
+    cycle.clear_ns = cleared - start;
+    cycle.root_scan_ns = scanned - cleared;
+    cycle.mark_ns = gc_now_ns() - scanned;
+}
+
+/**
+ * Marks the allocation that contains `word`, treating it as a possible
+ * (interior) pointer. Words outside the span of tracked allocations are
+ * rejected before the map lookup; slab objects are looked up in the heap.
+ *
+ * @param word The value to test.
+ * @param heap Heap whose slabs are consulted.
+ */
+void GarbageCollector::mark_conservative(uintptr_t word, Heap *heap) {
+    cycle.words_scanned++;
+
+    unsigned slot;
+    Heap::slab_t *slab = heap->slab_find((void *)word, &slot);
+    if (slab) {
+        void *object = Heap::slab_payload(slab, slot);
+        if ((uintptr_t)object <= word && mark_object(object, heap)) {
+            mark_stack.push_back(object);
+        }
+        return;
+    }
+
+    if (allocations.empty()) return;
+
+    uintptr_t lo = (uintptr_t)allocations.begin()->first;
+    auto last = allocations.rbegin();
+    uintptr_t hi = (uintptr_t)last->first + last->second->size;
+    if (word < lo || word >= hi) return;
+
+    auto alloc = allocations.upper_bound((void *)word);
+    --alloc;
+    if (word >= (uintptr_t)alloc->first + alloc->second->size) {
+        cycle.false_positives++; // Between objects: a header or a freed block
+        return;
+    }
+    if (mark_object(alloc->first, heap)) {
+        mark_stack.push_back(alloc->first);
+    }
+}
+
+/**
+ * Conservatively scans the stacks of all registered threads. The calling
+ * thread spills its registers into a jmp_buf on its own stack and is scanned
+ * from the current frame; every other thread is scanned from the top it
+ * recorded at its last safepoint(), along with its saved registers.
+ *
+ * @param heap Heap whose slabs are consulted.
+ */
+__attribute__((noinline))
+void GarbageCollector::scan_thread_stacks(Heap *heap) {
+    jmp_buf registers;
+    setjmp(registers);
+    uintptr_t *registers_start = (uintptr_t *)&registers;
+    uintptr_t *registers_end = (uintptr_t *)((char *)&registers + sizeof(registers));
+    for (uintptr_t *scan = registers_start; scan < registers_end; ++scan) {
+        mark_conservative(*scan, heap);
+    }
+
+    lock_guard<mutex> guard(threads_lock);
+    pthread_t self = pthread_self();
+    for (thread_root &t : threads) {
+        void *top;
+        if (pthread_equal(t.thread, self)) {
+            top = __builtin_frame_address(0);
+        } else {
+            top = t.stack_top;
+            uintptr_t *scan = (uintptr_t *)&t.registers;
+            uintptr_t *end = (uintptr_t *)((char *)&t.registers + sizeof(t.registers));
+            for (; scan < end; ++scan) {
+                mark_conservative(*scan, heap);
             }
         }
+        if (!top) continue;
+
+        uintptr_t *scan = (uintptr_t *)((uintptr_t)top & ~(uintptr_t)(sizeof(uintptr_t) - 1));
+        uintptr_t *end = (uintptr_t *)t.stack_base;
+        for (; scan < end; ++scan) {
+            mark_conservative(*scan, heap);
+        }
     }
 }
 
@@ -83,23 +373,55 @@ void GarbageCollector::mark() {
  * @param heap Pointer to the heap object used for deallocation.
  */
 list<void*> GarbageCollector::sweep(Heap *heap) {
+    uint64_t start = gc_now_ns();
+    GC_TRACE_BEGIN(TRACE_SWEEP);
     list<void*> deleted;
+    vector<void*> dead;
     for (auto block = allocations.begin(); block != allocations.end(); ) {
         if (!block->second->marked) {
-            void* dead = block->first;
+            cycle.bytes_freed += block->second->size;
+            dead.push_back(block->first);
             deleted.push_back(block->first);
-            GC_free(dead, heap);
-            block = allocations.begin();
+            reference_count.erase(block->first);
+            block = allocations.erase(block);
         } else {
+            if (block->second->age < 15) block->second->age++;
             ++block;
         }
     }
 
+    uint64_t swept = gc_now_ns();
+    cycle.objects_freed += dead.size();
+    GC_TRACE_END(TRACE_SWEEP);
+
+    // Dead blocks were collected in address order, so the heap can rebuild
+    // its free list in one pass instead of coalescing them one at a time.
+    GC_TRACE_BEGIN(TRACE_COALESCE);
+    heap->free_many(dead.data(), dead.size());
+    uint64_t merged = gc_now_ns();
+    GC_TRACE_END(TRACE_COALESCE);
+
+    // Slab objects are swept a bitmap word at a time
+    GC_TRACE_BEGIN(TRACE_SWEEP);
+    vector<void*> slab_dead;
+    heap->slab_sweep(slab_dead);
+    for (void *ptr : slab_dead) {
+        cycle.bytes_freed += ((allocation *)((char *)ptr - sizeof(allocation)))->size;
+        deleted.push_back(ptr);
+        reference_count.erase(ptr);
+    }
+    cycle.objects_freed += slab_dead.size();
+    uint64_t slabs_swept = gc_now_ns();
+    GC_TRACE_END(TRACE_SWEEP);
+
     // If nothing is left in allocations, reset heap structure
-    if (allocations.empty()) {
+    if (allocations.empty() && regions.empty() && heap->slab_count() == 0) {
         heap->reset();
     }
+    heap->scavenge();
 
+    cycle.sweep_ns = (swept - start) + (slabs_swept - merged);
+    cycle.coalesce_ns = (merged - swept) + (gc_now_ns() - slabs_swept);
     return deleted;
 }
 
@@ -108,11 +430,65 @@ list<void*> GarbageCollector::sweep(Heap *heap) {
  * reference count.
  * 
  * @param ptr Pointer to add to the root set.
+ * @return Index of the root slot holding the reference.
  */
-void GarbageCollector::add_reference(void *ptr) {
+size_t GarbageCollector::add_reference(void *ptr) {
     //cout << "Adding reference: " << ptr << " to root_set" << endl;
-    root_set.insert(ptr);
+    if (recorder) recorder->object_op(OP_REF, ptr);
+    return push_root(ptr);
+}
+
+/**
+ * Roots an object and counts the reference, without recording it: the
+ * root a new object starts with is implied by its allocation.
+ *
+ * @param ptr Pointer to add to the root set.
+ * @return Index of the root slot holding the reference.
+ */
+size_t GarbageCollector::push_root(void *ptr) {
     reference_count[ptr] += 1;
+    return root_set.push(ptr);
+}
+
+/**
+ * Releases a root slot and decrements the reference count of the object
+ * it held.
+ *
+ * @param slot Index of the root slot to release.
+ * @return 0 if successful, -1 if the slot was not in use.
+ */
+int GarbageCollector::release_reference(size_t slot) {
+    if (slot >= root_set.size()) return -1;
+    void *ptr = root_set.get(slot);
+    if (!ptr) return -1;
+    if (recorder) recorder->object_op(OP_DELREF, ptr);
+    root_set.release(slot);
+
+    auto rc_it = reference_count.find(ptr);
+    if (rc_it != reference_count.end()) {
+        rc_it->second--;
+        if (rc_it->second < 0)
+            rc_it->second = 0;
+    }
+    return 0;
+}
+
+/**
+ * Releases all root slots at or above `top` in one pass.
+ *
+ * @param top Root table top to return to.
+ */
+void GarbageCollector::release_references(size_t top) {
+    for (size_t slot = top; slot < root_set.size(); slot++) {
+        void *ptr = root_set.get(slot);
+        if (!ptr) continue;
+        if (recorder) recorder->object_op(OP_DELREF, ptr);
+        auto rc_it = reference_count.find(ptr);
+        if (rc_it != reference_count.end() && rc_it->second > 0) {
+            rc_it->second--;
+        }
+    }
+    root_set.truncate(top);
 }
 
 /**
@@ -123,13 +499,15 @@ void GarbageCollector::add_reference(void *ptr) {
  * 
  * @param src Pointer to the memory block that's being modified
  * @param dest Pointer to the memory block that's being referenced
- * @return 0 if successful, -1 on failure.
+ * @param field Index of the pointer-sized field of `src` to write
+ * @return 0 if successful, -1 on failure (the field is outside the block).
  */
-int GarbageCollector::add_nested_reference(void *src, void *dest) {
+int GarbageCollector::add_nested_reference(void *src, void *dest, size_t field) {
     allocation *alloc = (allocation *)((char*)src - sizeof(allocation));
-    if (alloc->size >= sizeof(void *)) {
-        ((void **)src)[0] = dest;
+    if (alloc->size >= (field + 1) * sizeof(void *)) {
+        ((void **)src)[field] = dest;
         reference_count[dest]++;
+        if (recorder) recorder->nested(src, dest, field);
     } else {
         return -1;
     }
@@ -151,16 +529,92 @@ void GarbageCollector::delete_reference(void *ptr) {
         reference_count[ptr]--;
     }
     */
-   auto it = root_set.find(ptr);
-   if (it == root_set.end()) return;
-   root_set.erase(it);
+   size_t slot;
+   if (!root_set.find(ptr, &slot)) return;
+   release_reference(slot);
+}
+
+/**
+ * Enables or disables conservative scanning of registered thread stacks.
+ *
+ * @param enabled True to scan thread stacks during mark().
+ */
+void GarbageCollector::set_conservative_roots(bool enabled) {
+    conservative_roots = enabled;
+}
+
+/**
+ * Registers the calling thread's stack for conservative scanning.
+ *
+ * @param stack_base Highest address of the stack, or NULL to query pthreads.
+ */
+void GarbageCollector::register_thread(void *stack_base) {
+    if (stack_base == NULL) {
+        pthread_attr_t attr;
+        void *addr = NULL;
+        size_t size = 0;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            pthread_attr_getstack(&attr, &addr, &size);
+            pthread_attr_destroy(&attr);
+        }
+        stack_base = (char *)addr + size;
+    }
 
-   auto rc_it = reference_count.find(ptr);
-   if (rc_it != reference_count.end()) {
-       rc_it->second--;
-       if (rc_it->second < 0)
-           rc_it->second = 0;
-   }
+    lock_guard<mutex> guard(threads_lock);
+    threads.emplace_back();
+    thread_root &t = threads.back();
+    t.thread = pthread_self();
+    t.stack_base = stack_base;
+    t.stack_top = NULL;
+}
+
+/**
+ * Removes the calling thread from conservative scanning.
+ */
+void GarbageCollector::unregister_thread() {
+    lock_guard<mutex> guard(threads_lock);
+    pthread_t self = pthread_self();
+    for (auto t = threads.begin(); t != threads.end(); ++t) {
+        if (pthread_equal(t->thread, self)) {
+            threads.erase(t);
+            return;
+        }
+    }
+}
+
+/**
+ * Publishes the calling thread's stack top and registers for a collector
+ * running on another thread.
+ */
+__attribute__((noinline))
+void GarbageCollector::safepoint() {
+    lock_guard<mutex> guard(threads_lock);
+    pthread_t self = pthread_self();
+    for (thread_root &t : threads) {
+        if (pthread_equal(t.thread, self)) {
+            setjmp(t.registers);
+            t.stack_top = __builtin_frame_address(0);
+            return;
+        }
+    }
+}
+
+/**
+ * Adds a region to the set of root sources scanned by mark().
+ *
+ * @param region Region to scan.
+ */
+void GarbageCollector::add_region(Region *region) {
+    regions.push_back(region);
+}
+
+/**
+ * Removes a region from the root sources.
+ *
+ * @param region Region to forget.
+ */
+void GarbageCollector::remove_region(Region *region) {
+    regions.remove(region);
 }
 
 /**
@@ -169,8 +623,24 @@ void GarbageCollector::delete_reference(void *ptr) {
  * @param heap Pointer to the heap to be garbage collected.
  */
 list<void*> GarbageCollector::ms_collect(Heap *heap) {
-    mark();
-    return sweep(heap);
+    cycle = GcStats();
+    cycle.kind = GcStats::MARK_SWEEP;
+    uint64_t start = gc_now_ns();
+    GC_TRACE_BEGIN(TRACE_MS_COLLECT);
+
+    mark(heap);
+    list<void*> deleted = sweep(heap);
+
+    cycle.pause_ns = gc_now_ns() - start;
+    totals.add(cycle);
+    GC_TRACE_END(TRACE_MS_COLLECT, cycle.objects_freed, cycle.bytes_freed);
+    if (recorder) recorder->collect(pacing ? OP_MS_PACED : OP_MS, deleted);
+    if (profiler) profiler->collected(deleted);
+    collection_done(heap, deleted);
+#ifdef DEBUGMODE
+    verify_collection(heap, "mark-and-sweep");
+#endif
+    return deleted;
 }
 
 /**
@@ -179,22 +649,198 @@ list<void*> GarbageCollector::ms_collect(Heap *heap) {
  * @param heap Pointer to the heap to be garbage collected.
  */
 list<void*> GarbageCollector::rc_collect(Heap *heap) {
+    cycle = GcStats();
+    cycle.kind = GcStats::REF_COUNT;
+    uint64_t start = gc_now_ns();
+    GC_TRACE_BEGIN(TRACE_RC_COLLECT);
+    GC_TRACE_BEGIN(TRACE_SWEEP);
+
     list<void*> deleted;
+    vector<void*> dead;
     for (auto block = reference_count.begin(); block != reference_count.end(); ) {
         if (block->second <= 0) {
-            void* dead = block->first;
             deleted.push_back(block->first);
-            GC_free(dead, heap);
-            block = reference_count.begin();
+            if (allocations.erase(block->first) || heap->is_slab_object(block->first)) {
+                cycle.bytes_freed += ((allocation *)((char *)block->first - sizeof(allocation)))->size;
+                dead.push_back(block->first);
+            }
+            block = reference_count.erase(block);
         } else {
             ++block;
         }
     }
+    cycle.objects_freed = dead.size();
+    uint64_t swept = gc_now_ns();
+    GC_TRACE_END(TRACE_SWEEP);
+
+    GC_TRACE_BEGIN(TRACE_COALESCE);
+    heap->free_many(dead.data(), dead.size());
+    heap->scavenge();
+    GC_TRACE_END(TRACE_COALESCE);
+
+    uint64_t end = gc_now_ns();
+    cycle.sweep_ns = swept - start;
+    cycle.coalesce_ns = end - swept;
+    cycle.pause_ns = end - start;
+    totals.add(cycle);
+    GC_TRACE_END(TRACE_RC_COLLECT, cycle.objects_freed, cycle.bytes_freed);
+    if (recorder) recorder->collect(OP_RC, deleted);
+    if (profiler) profiler->collected(deleted);
+    collection_done(heap, deleted);
+#ifdef DEBUGMODE
+    verify_collection(heap, "reference counting");
+#endif
     return deleted;
 }
 
 /**
- * Frees a block from the heap, removing its reference in the allocation and reference count lists
+ * Sets the pacer's ratio.
+ *
+ * @param percent New ratio, negative to turn the pacer off.
+ * @return The previous ratio.
+ */
+int GarbageCollector::set_gc_percent(int percent) {
+    int previous = gc_percent;
+    gc_percent = percent;
+    return previous;
+}
+
+/**
+ * @return Bytes allocated since the last collection may grow to this
+ *         before the pacer collects: `gc_percent`% of the live heap.
+ */
+size_t GarbageCollector::pacer_trigger() const {
+    return max((size_t)((uint64_t)live_after_gc * gc_percent / 100), (size_t)GC_MIN_TRIGGER);
+}
+
+/**
+ * @return Bytes left before the pacer's next collection, or SIZE_MAX.
+ */
+size_t GarbageCollector::next_collection() const {
+    if (gc_percent < 0) return SIZE_MAX;
+    size_t trigger = pacer_trigger();
+    return allocated_since_gc < trigger ? trigger - allocated_since_gc : 0;
+}
+
+/**
+ * Counts an allocation and collects once the trigger is reached. If the
+ * live data then leaves less free memory than the next trigger, the heap
+ * grows by the difference, as far as its reservation allows.
+ *
+ * @param bytes Bytes about to be allocated.
+ * @param heap The heap being allocated from.
+ */
+void GarbageCollector::pace(size_t bytes, Heap *heap) {
+    allocated_since_gc += bytes;
+    if (gc_percent < 0 || allocated_since_gc < pacer_trigger()) return;
+
+    paced_collect(heap);
+    size_t headroom = pacer_trigger();
+    size_t available = heap->available_memory();
+    size_t room = heap->max_size() - heap->heap_size;
+    if (available < headroom && room > 0) {
+        heap->grow(min(headroom - available, room));
+    }
+}
+
+/**
+ * Frees or adds memory for an allocation that failed: collects on the
+ * first attempt, then grows the heap by the request plus the pacer's
+ * headroom, or by whatever the reservation has left if that covers the
+ * request. A large object failed in its own mmap, so only the collection
+ * is tried for it.
+ *
+ * @param bytes Heap bytes the request needs, or 0 for a large object.
+ * @param heap The heap being allocated from.
+ * @param attempt Retries so far.
+ * @return True if something changed and the allocation should be retried.
+ */
+bool GarbageCollector::make_room(size_t bytes, Heap *heap, int attempt) {
+    if (gc_percent < 0) return false;
+    if (attempt == 0) {
+        paced_collect(heap);
+        return true;
+    }
+    size_t room = heap->max_size() - heap->heap_size;
+    if (attempt > 1 || bytes == 0 || room < bytes) return false;
+    return heap->grow(min(bytes + pacer_trigger(), room));
+}
+
+/**
+ * Runs a mark-and-sweep collection on the pacer's behalf, so that a trace
+ * being recorded tells it apart from one the program asked for.
+ *
+ * @param heap The heap being allocated from.
+ */
+void GarbageCollector::paced_collect(Heap *heap) {
+    pacing = true;
+    ms_collect(heap);
+    pacing = false;
+}
+
+/**
+ * Restarts the pacer's count from the live size left by a collection and
+ * passes the victims to the collection hook.
+ *
+ * @param heap The heap just collected.
+ * @param deleted Objects the collection freed.
+ */
+void GarbageCollector::collection_done(Heap *heap, const list<void*> &deleted) {
+    allocated_since_gc = 0;
+    live_after_gc = heap->used_memory();
+    if (collection_hook) collection_hook(deleted);
+}
+
+/**
+ * Explicitly frees an object the caller knows to be dead, without waiting
+ * for a collection. Any root slots still holding it are released.
+ *
+ * @param ptr Pointer returned by malloc().
+ * @param heap Pointer to the heap the object was allocated from.
+ */
+void GarbageCollector::free(void *ptr, Heap *heap) {
+    if (allocations.find(ptr) == allocations.end() && !heap->is_slab_object(ptr)) return;
+    GC_TRACE_INSTANT(TRACE_FREE, (uintptr_t)ptr);
+    if (recorder) recorder->object_op(OP_FREE, ptr);
+    if (profiler) profiler->freed(ptr);
+
+    root_set.release_all(ptr);
+    GC_free(ptr, heap);
+}
+
+/**
+ * Explicitly frees a batch of objects. Unknown pointers are ignored; the
+ * rest are unregistered and handed to the heap in one bulk release.
+ *
+ * @param ptrs Array of pointers returned by malloc(). Reordered by address.
+ * @param n Number of entries in `ptrs`.
+ * @param heap Pointer to the heap the objects were allocated from.
+ */
+void GarbageCollector::free_many(void **ptrs, size_t n, Heap *heap) {
+    // A slab object listed twice would pass is_slab_object() twice
+    sort(ptrs, ptrs + n);
+    n = unique(ptrs, ptrs + n) - ptrs;
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (allocations.erase(ptrs[i]) || heap->is_slab_object(ptrs[i])) {
+            if (recorder) recorder->object_op(OP_FREE, ptrs[i]);
+            if (profiler) profiler->freed(ptrs[i]);
+            reference_count.erase(ptrs[i]);
+            ptrs[kept++] = ptrs[i];
+        }
+    }
+
+    // The root index finds each object's slots without walking the table
+    for (size_t i = 0; i < kept; i++) {
+        root_set.release_all(ptrs[i]);
+    }
+    heap->free_many(ptrs, kept);
+}
+
+/**
+ * Frees a block from the heap, removing its reference in the allocation and reference count lists.
+ * The root set is left alone: both collectors only free blocks that no root slot holds
+ * (unmarked blocks, or blocks whose count, which includes every root, is zero).
  * 
  * @param ptr pointer to a block to free and be removed from the allocation and reference_count list 
  * @param heap Pointer to the heap to be garbage collected.
@@ -204,5 +850,135 @@ void GarbageCollector::GC_free(void * ptr, Heap* heap){
     heap->my_free(ptr);
     allocations.erase(ptr);
     reference_count.erase(ptr);
-    root_set.erase(ptr);
-}
\ No newline at end of file
+}
+
+/**
+ * Verifies the heap, then cross-checks `allocations`, `reference_count` and
+ * the root set against it and against each other.
+ *
+ * @param heap The heap the objects were allocated from.
+ * @param error Optional output describing the first inconsistency.
+ * @return True if no inconsistency was found.
+ */
+bool GarbageCollector::verify(Heap *heap, string *error) {
+    vector<void*> blocks;
+    if (!heap->verify(error, &blocks)) {
+        return false;
+    }
+
+    char message[160];
+    auto fail = [&](const char *format, const void *where, long value) {
+        snprintf(message, sizeof(message), format, where, value);
+        if (error) *error = message;
+        return false;
+    };
+    auto live = [&](void *ptr) {
+        return allocations.count(ptr) || heap->is_slab_object(ptr);
+    };
+
+    for (auto &entry : allocations) {
+        allocation *header = (allocation *)((char *)entry.first - sizeof(allocation));
+        if (entry.second != header || header->slab) {
+            return fail("allocation %p has a stale header (size %ld)", entry.first, (long)header->size);
+        }
+        if (header->large ? !heap->is_large_object(entry.first)
+                          : !binary_search(blocks.begin(), blocks.end(), entry.first)) {
+            return fail("allocation %p is not an allocated block (size %ld)", entry.first, (long)header->size);
+        }
+    }
+
+    map<void*, long> roots;
+    for (size_t slot = 0; slot < root_set.size(); slot++) {
+        void *root = root_set.get(slot);
+        if (!root) continue;
+        if (!live(root)) {
+            return fail("root %p is not a live object (slot %ld)", root, (long)slot);
+        }
+        roots[root]++;
+    }
+
+    for (auto &count : reference_count) {
+        if (!live(count.first)) {
+            return fail("reference count of %p outlives the object (count %ld)", count.first, count.second);
+        }
+        auto rooted = roots.find(count.first);
+        if (count.second < 0 || (rooted != roots.end() && count.second < rooted->second)) {
+            return fail("reference count of %p is below its root slots (count %ld)", count.first, count.second);
+        }
+    }
+    return true;
+}
+
+/**
+ * Aborts with a description of the problem if verification after a
+ * collection is enabled and fails.
+ *
+ * @param heap The heap just collected.
+ * @param collector Name of the collection, for the message.
+ */
+void GarbageCollector::verify_collection(Heap *heap, const char *collector) {
+    if (!verify_collections) return;
+    string error;
+    if (!verify(heap, &error)) {
+        cerr << "Heap verification failed after " << collector << " collection: " << error << endl;
+        abort();
+    }
+}
+
+/**
+ * Starts writing every allocation, root change, nested reference, free and
+ * collection to a trace file, replacing any trace already being written.
+ *
+ * @param path File to create.
+ * @return True if the file could be created.
+ */
+bool GarbageCollector::start_recording(const char *path) {
+    if (recorder == NULL) {
+        recorder = new AllocationRecorder();
+    }
+    if (!recorder->open(path)) {
+        delete recorder;
+        recorder = NULL;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Stops recording and closes the trace file.
+ *
+ * @return True if the whole trace was written.
+ */
+bool GarbageCollector::stop_recording() {
+    if (recorder == NULL) return true;
+    bool ok = recorder->close();
+    delete recorder;
+    recorder = NULL;
+    return ok;
+}
+
+/**
+ * Replaces any running profile with an empty one.
+ *
+ * @param sample_rate Mean bytes between samples.
+ */
+void GarbageCollector::start_profiling(size_t sample_rate) {
+    delete profiler;
+    profiler = new AllocationProfiler(sample_rate);
+}
+
+/**
+ * Stops sampling and frees the profile.
+ */
+void GarbageCollector::stop_profiling() {
+    delete profiler;
+    profiler = NULL;
+}
+
+/**
+ * Closes a trace left open and frees the profile, if any.
+ */
+GarbageCollector::~GarbageCollector() {
+    stop_recording();
+    stop_profiling();
+}
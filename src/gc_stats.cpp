@@ -0,0 +1,74 @@
+#include <string.h>
+#include <gc_stats.h>
+
+/**
+ * Adds a sample to its power-of-two bucket.
+ *
+ * @param value The sample.
+ */
+void GcHistogram::record(uint64_t value) {
+    unsigned bucket = value ? 64 - __builtin_clzll(value) : 0;
+    if (bucket >= GC_HISTOGRAM_BUCKETS) bucket = GC_HISTOGRAM_BUCKETS - 1;
+    buckets[bucket]++;
+    count++;
+    sum += value;
+    if (value < min) min = value;
+    if (value > max) max = value;
+}
+
+/**
+ * Resets the histogram to no samples.
+ */
+void GcHistogram::clear() {
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    sum = 0;
+    min = UINT64_MAX;
+    max = 0;
+}
+
+/**
+ * Walks the buckets until `q` of the samples are covered and returns that
+ * bucket's upper bound, clamped to the largest sample seen.
+ *
+ * @param q Quantile in [0, 1].
+ * @return An upper bound on the quantile.
+ */
+uint64_t GcHistogram::quantile(double q) const {
+    if (count == 0) return 0;
+    uint64_t wanted = (uint64_t)(q * count);
+    if (wanted == 0) wanted = 1;
+
+    uint64_t seen = 0;
+    for (unsigned bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= wanted) {
+            uint64_t bound = bucket == 0 ? 0 : (1ULL << bucket) - 1;
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
+
+/**
+ * Adds a collection's counters to the totals and its timings to the histograms.
+ *
+ * @param cycle The finished collection.
+ */
+void GcTotals::add(const GcStats &cycle) {
+    collections++;
+    if (cycle.kind == GcStats::MARK_SWEEP) {
+        ms_collections++;
+        mark_ns.record(cycle.mark_ns);
+    } else {
+        rc_collections++;
+    }
+    objects_freed += cycle.objects_freed;
+    bytes_freed += cycle.bytes_freed;
+    words_scanned += cycle.words_scanned;
+    false_positives += cycle.false_positives;
+
+    pause_ns.record(cycle.pause_ns);
+    sweep_ns.record(cycle.sweep_ns);
+    bytes_freed_per_cycle.record(cycle.bytes_freed);
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <gc_trace.h>
+#include <gc_stats.h>
+
+/**
+ * A thread's ring buffer. `head` counts every record ever written; the
+ * owning thread publishes it with a release store after filling the slot,
+ * so a reader sees complete records up to the head it loads. Only the owner
+ * writes `head`: gc_trace_clear() moves `cleared` up to it instead, and
+ * readers skip the records below.
+ */
+typedef struct trace_ring {
+    gc_trace_record records[GC_TRACE_RING_RECORDS];
+    atomic<uint64_t> head;
+    uint64_t cleared; // Head at the last gc_trace_clear(), under rings_lock
+    uint32_t thread;
+} trace_ring;
+
+// Every ring ever created. Rings outlive their threads so they can still be dumped.
+static vector<trace_ring *> rings;
+static mutex rings_lock;
+static atomic<uint32_t> next_thread(1);
+
+static thread_local trace_ring *local_ring = NULL;
+
+static const char *event_names[TRACE_EVENT_COUNT] = {
+    "malloc", "free", "free_many", "large_malloc", "large_free",
+    "ms_collect", "rc_collect", "clear", "root_scan", "mark",
+    "sweep", "coalesce", "scavenge", "heap_grow"
+};
+
+/**
+ * Creates and registers the calling thread's ring.
+ *
+ * @return The new ring.
+ */
+static trace_ring *register_ring() {
+    trace_ring *ring = new trace_ring();
+    ring->head.store(0, memory_order_relaxed);
+    ring->cleared = 0;
+    ring->thread = next_thread.fetch_add(1, memory_order_relaxed);
+
+    lock_guard<mutex> guard(rings_lock);
+    rings.push_back(ring);
+    return ring;
+}
+
+/**
+ * Writes a record into the calling thread's ring.
+ *
+ * @param event What happened.
+ * @param phase 'B', 'E' or 'i'.
+ * @param arg0 Event specific argument.
+ * @param arg1 Event specific argument.
+ */
+void gc_trace_emit(gc_trace_event_t event, char phase, uint64_t arg0, uint64_t arg1) {
+    trace_ring *ring = local_ring;
+    if (ring == NULL) {
+        ring = local_ring = register_ring();
+    }
+
+    uint64_t head = ring->head.load(memory_order_relaxed);
+    gc_trace_record &record = ring->records[head & (GC_TRACE_RING_RECORDS - 1)];
+    record.timestamp_ns = gc_now_ns();
+    record.arg0 = arg0;
+    record.arg1 = arg1;
+    record.thread = ring->thread;
+    record.event = event;
+    record.phase = phase;
+    ring->head.store(head + 1, memory_order_release);
+}
+
+/**
+ * Empties every ring by marking its current head as cleared. Threads may
+ * keep tracing meanwhile: their records land above the mark and are kept.
+ */
+void gc_trace_clear() {
+    lock_guard<mutex> guard(rings_lock);
+    for (trace_ring *ring : rings) {
+        ring->cleared = ring->head.load(memory_order_acquire);
+    }
+}
+
+/**
+ * Copies the retained records of every ring, oldest first, and writes them
+ * out. A ring that wrapped keeps only its last GC_TRACE_RING_RECORDS records.
+ *
+ * @param path File to create.
+ * @return Number of records written, or -1 on failure.
+ */
+long gc_trace_write(const char *path) {
+    vector<gc_trace_record> records;
+    {
+        lock_guard<mutex> guard(rings_lock);
+        for (trace_ring *ring : rings) {
+            uint64_t head = ring->head.load(memory_order_acquire);
+            uint64_t first = head > GC_TRACE_RING_RECORDS ? head - GC_TRACE_RING_RECORDS : 0;
+            first = max(first, ring->cleared);
+            for (uint64_t i = first; i < head; i++) {
+                records.push_back(ring->records[i & (GC_TRACE_RING_RECORDS - 1)]);
+            }
+        }
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return -1;
+    }
+    uint64_t count = records.size();
+    bool ok = fwrite(GC_TRACE_MAGIC, 1, 8, file) == 8 &&
+              fwrite(&count, sizeof(count), 1, file) == 1 &&
+              fwrite(records.data(), sizeof(gc_trace_record), count, file) == count;
+    ok = fclose(file) == 0 && ok;
+    return ok ? (long)count : -1;
+}
+
+/**
+ * Loads a trace file and merges the per-thread streams by timestamp.
+ *
+ * @param path File to read.
+ * @param records Output: the records.
+ * @return True on success.
+ */
+bool gc_trace_read(const char *path, vector<gc_trace_record> &records) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    char magic[8];
+    uint64_t count = 0;
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, GC_TRACE_MAGIC, 8) == 0 &&
+              fread(&count, sizeof(count), 1, file) == 1;
+    if (ok) {
+        records.resize(count);
+        ok = fread(records.data(), sizeof(gc_trace_record), count, file) == count;
+    }
+    fclose(file);
+    if (!ok) {
+        records.clear();
+        return false;
+    }
+
+    stable_sort(records.begin(), records.end(),
+                [](const gc_trace_record &a, const gc_trace_record &b) {
+                    return a.timestamp_ns < b.timestamp_ns;
+                });
+    return true;
+}
+
+/**
+ * Writes the Chrome trace event format: one JSON object per record in a
+ * `traceEvents` array. Instants are thread scoped; begin records carry no
+ * arguments.
+ *
+ * @param records Records sorted by timestamp.
+ * @param out Stream to write to.
+ */
+void gc_trace_to_json(const vector<gc_trace_record> &records, ostream &out) {
+    out << "{\"traceEvents\":[";
+    for (size_t i = 0; i < records.size(); i++) {
+        const gc_trace_record &record = records[i];
+        char line[256];
+        int n = snprintf(line, sizeof(line),
+                         "%s\n{\"name\":\"%s\",\"cat\":\"gc\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u",
+                         i ? "," : "", gc_trace_event_name(record.event), (char)record.phase,
+                         record.timestamp_ns / 1000.0, record.thread);
+        out.write(line, n);
+        if (record.phase == 'i') {
+            out << ",\"s\":\"t\"";
+        }
+        if (record.phase != 'B') {
+            n = snprintf(line, sizeof(line), ",\"args\":{\"arg0\":%llu,\"arg1\":%llu}",
+                         (unsigned long long)record.arg0, (unsigned long long)record.arg1);
+            out.write(line, n);
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+/**
+ * @param event A gc_trace_event_t.
+ * @return Its name, or "unknown".
+ */
+const char *gc_trace_event_name(uint16_t event) {
+    return event < TRACE_EVENT_COUNT ? event_names[event] : "unknown";
+}
@@ -1,10 +1,13 @@
 #include <stdlib.h>
+#include <unistd.h>
 #include <sys/mman.h>
 #include <iostream>
 #include <string>
 #include <heap.h>
 #include <gc.h>
+#include <gc_trace.h>
 #include <assert.h>
+#include <algorithm>
 
 using namespace std;
 using Allocation = GarbageCollector::allocation;
@@ -12,6 +15,66 @@ using Allocation = GarbageCollector::allocation;
 //Heap::node_t *head = NULL;
 //Heap::node_t *tail = NULL;
 
+/**
+ * Maps the heap region. For huge pages the mapping is a whole number of
+ * HUGE_PAGE_SIZE pages aligned to HUGE_PAGE_SIZE, with the tail sentinel in
+ * its last bytes: an over-sized reservation is trimmed to the aligned part
+ * and then advised with MADV_HUGEPAGE, or MAP_HUGETLB is tried first when
+ * explicitly configured.
+ *
+ * @return Start of the mapping, or NULL on failure.
+ */
+char *Heap::map_heap() {
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_ANON | MAP_PRIVATE;
+
+    if (max_heap_size > heap_size) {
+        heap_size -= (heap_size + sizeof(Allocation)) % HEAP_ALIGN;
+        map_length = max_heap_size - (max_heap_size + sizeof(Allocation)) % HEAP_ALIGN + sizeof(node_t);
+        char *base = (char *)mmap(NULL, map_length, PROT_NONE, flags | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            return NULL;
+        }
+        size_t page = sysconf(_SC_PAGESIZE);
+        committed = (heap_size + sizeof(node_t) + page - 1) / page * page;
+        if (mprotect(base, committed, prot) != 0) {
+            munmap(base, map_length);
+            return NULL;
+        }
+        return base;
+    }
+
+    if (pages != PAGES_NORMAL) {
+        size_t length = (heap_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+        if (pages == PAGES_HUGETLB) {
+            void *base = mmap(NULL, length, prot, flags | MAP_HUGETLB, -1, 0);
+            if (base != MAP_FAILED) {
+                map_length = length;
+                heap_size = length - sizeof(node_t);
+                return (char *)base;
+            }
+        }
+
+        char *raw = (char *)mmap(NULL, length + HUGE_PAGE_SIZE, prot, flags, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *base = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (base > raw) {
+                munmap(raw, base - raw);
+            }
+            munmap(base + length, raw + HUGE_PAGE_SIZE - base);
+            madvise(base, length, MADV_HUGEPAGE);
+            map_length = length;
+            heap_size = length - sizeof(node_t);
+            return base;
+        }
+    }
+
+    map_length = heap_size + sizeof(node_t);
+    void *base = mmap(NULL, map_length, prot, flags, -1, 0);
+    return base == MAP_FAILED ? NULL : (char *)base;
+}
+
 /**
  * Initializes the heap if it has not been created yet.
  * Uses `mmap` to allocate a contiguous block of memory and sets up the free list.
@@ -20,13 +83,15 @@ using Allocation = GarbageCollector::allocation;
  */
 Heap::node_t* Heap::start() {
     if (this->tail == nullptr) {
-        this->head = (node_t *)mmap(NULL, HEAP_SIZE + sizeof(node_t),
-                              PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-        this->tail = (node_t *)((char *)this->head + HEAP_SIZE);
-        this->head->size = HEAP_SIZE - sizeof(node_t);
+        this->heap_base = Heap::map_heap();
+        assert(this->heap_base != NULL);
+        this->head = (node_t *)(this->heap_base + HEAP_ALIGN - sizeof(Allocation));
+        this->tail = (node_t *)(this->heap_base + heap_size);
+        this->head->size = (char *)this->tail - (char *)this->head - sizeof(node_t);
         this->head->next = tail;
         this->tail->size = 0;
         this->tail->next = NULL;
+        Heap::index_add(this->head);
     }
     return this->head;
 }
@@ -35,31 +100,134 @@ Heap::node_t* Heap::start() {
  * Resets the heap by unmapping the current region and reinitializing it.
  */
 void Heap::reset() {
-    if (this->head != NULL) {
-        munmap(this->head, HEAP_SIZE + sizeof(node_t));
+    for (large_object &large : large_objects) {
+        munmap(large.base, large.length);
+    }
+    large_objects.clear();
+
+    if (this->heap_base != NULL) {
+        munmap(this->heap_base, map_length);
+        this->heap_base = NULL;
         this->head = NULL;
+        free_by_size.clear();
+        free_by_addr.clear();
+        free_sizes.clear();
+        free_bytes = 0;
+        free_blocks = 0;
+        rover = NULL;
+        slabs.clear();
+        for (auto &size_class : size_classes) {
+            size_class.second.clear();
+        }
         this->tail = NULL;
         Heap::start();
     }
 }
 
 /**
- * Calculates and returns the total amount of available (free) memory in the heap.
+ * Grows the heap into its reservation. The old tail sentinel becomes the
+ * node of a free block covering the new bytes, which is appended to the
+ * free list and merged with the last free block if the two touch.
+ *
+ * @param bytes Number of bytes to add.
+ * @return True if the heap grew.
+ */
+bool Heap::grow(size_t bytes) {
+    Heap::start();
+    bytes = (bytes + HEAP_ALIGN - 1) & ~(size_t)(HEAP_ALIGN - 1);
+    if (bytes == 0 || heap_size + bytes > max_size()) {
+        return false;
+    }
+
+    size_t end = heap_size + bytes + sizeof(node_t);
+    if (end > committed) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t length = min((end + page - 1) / page * page, map_length);
+        if (mprotect(this->heap_base + committed, length - committed, PROT_READ | PROT_WRITE) != 0) {
+            return false;
+        }
+        committed = length;
+    }
+
+    node_t *last = NULL;
+    for (node_t *p = this->head; p != tail; p = p->next) {
+        last = p;
+    }
+    node_t *block = this->tail;
+    heap_size += bytes;
+    this->tail = (node_t *)(this->heap_base + heap_size);
+    this->tail->size = 0;
+    this->tail->next = NULL;
+    if (last) {
+        last->next = this->tail;
+    } else {
+        this->head = this->tail;
+    }
+
+    block->size = bytes - sizeof(node_t);
+    Heap::coalesce(block);
+    GC_TRACE_INSTANT(TRACE_HEAP_GROW, bytes, heap_size);
+    return true;
+}
+
+/**
+ * Returns the total amount of available (free) memory in the heap.
  *
  * @return The number of free bytes in the heap.
  */
 size_t Heap::available_memory() {
-    size_t n = 0;
-    node_t *p = Heap::start();
-    while (p != tail) {
-        n += p->size;
-        p = p->next;
+    Heap::start();
+    return free_bytes;
+}
+
+/**
+ * Returns the bytes of the free-list heap not on the free list: everything
+ * between the first block and the tail sentinel minus the free blocks and
+ * their node headers.
+ *
+ * @return The number of allocated bytes, headers included.
+ */
+size_t Heap::used_memory() {
+    Heap::start();
+    size_t arena = heap_size - (HEAP_ALIGN - sizeof(Allocation));
+    return arena - free_bytes - free_blocks * sizeof(node_t);
+}
+
+/**
+ * @return The number of blocks on the free list.
+ */
+size_t Heap::free_block_count() {
+    Heap::start();
+    return free_blocks;
+}
+
+/**
+ * @return The size of the largest free block, or 0 if there is none.
+ */
+size_t Heap::largest_free_block() {
+    Heap::start();
+    return free_sizes.empty() ? 0 : free_sizes.rbegin()->first;
+}
+
+/**
+ * Computes the fragmentation ratio from the counters.
+ *
+ * @return 1 - largest free block / free bytes, or 0 when nothing is free.
+ */
+double Heap::fragmentation() {
+    size_t free = Heap::available_memory();
+    if (free == 0) {
+        return 0.0;
     }
-    return n;
+    return 1.0 - (double)Heap::largest_free_block() / free;
 }
 
 /**
- * Finds the first free block large enough to satisfy the requested size.
+ * Finds a free block large enough to satisfy the requested size: the first
+ * one in address order under FIRST_FIT, the smallest one under BEST_FIT, or
+ * the first one after the rover under NEXT_FIT. Next-fit leaves the rover on
+ * the found block's predecessor, so the following search resumes at the
+ * remainder of the split instead of rescanning the small fragments near head.
  *
  * @param size The number of bytes needed.
  * @param found Output parameter that will point to the suitable free block.
@@ -70,8 +238,43 @@ void Heap::find_free(size_t size, node_t **found, node_t **prev) {
     *found = NULL;
     *prev = NULL;
 
+    if (policy == BEST_FIT) {
+        // Smallest block that fits (lowest address on ties), then its list predecessor
+        size_t least = size - (sizeof(node_t) - sizeof(Allocation));
+        auto best = free_by_size.lower_bound(make_pair(least, (node_t *)NULL));
+        if (best == free_by_size.end()) return;
+        *found = best->second;
+        auto pos = free_by_addr.find(*found);
+        if (pos != free_by_addr.begin()) {
+            *prev = *--pos;
+        }
+        return;
+    }
+
+    if (policy == NEXT_FIT) {
+        // Resume after the rover, wrapping around to the head once
+        node_t *start = rover ? rover->next : curr;
+        *prev = rover;
+        curr = start;
+        for (int pass = 0; pass < 2; pass++) {
+            while (curr != tail && (pass == 0 || curr != start)) {
+                if (capacity(curr) >= size) {
+                    *found = curr;
+                    rover = *prev;
+                    return;
+                }
+                *prev = curr;
+                curr = curr->next;
+            }
+            if (rover == NULL) return; // The first pass already covered the whole list
+            *prev = NULL;
+            curr = this->head;
+        }
+        return;
+    }
+
     while (curr != tail) {
-        if (curr->size >= size) {
+        if (capacity(curr) >= size) {
             *found = curr;
             return;
         } else {
@@ -83,6 +286,8 @@ void Heap::find_free(size_t size, node_t **found, node_t **prev) {
 
 /**
  * Splits a free block into an allocated block and a smaller free block.
+ * A next-fit rover on the block moves to the remainder, or to the block's
+ * predecessor when nothing remains.
  *
  * @param size The size of the memory to allocate (excluding metadata).
  * @param prev Pointer to the previous node in the free list.
@@ -96,10 +301,20 @@ void Heap::split(size_t size, node_t **prev, node_t **free_block,
     node_t *temp = *free_block;
     size_t actual_size = size + sizeof(Allocation);
     size_t original_size = temp->size;
+    Heap::index_remove(temp);
 
-    *free_block = (node_t *)((char *)temp + actual_size);
-    (*free_block)->size = original_size - actual_size;
-    (*free_block)->next = temp->next;
+    if (original_size < actual_size) {
+        // The remainder could not hold a free node, so hand out the whole block
+        size = capacity(temp);
+        *free_block = temp->next;
+        if (rover == temp) rover = *prev;
+    } else {
+        *free_block = (node_t *)((char *)temp + actual_size);
+        (*free_block)->size = original_size - actual_size;
+        (*free_block)->next = temp->next;
+        Heap::index_add(*free_block);
+        if (rover == temp) rover = *free_block;
+    }
 
     if (*prev == NULL) {
         this->head = *free_block;
@@ -108,8 +323,8 @@ void Heap::split(size_t size, node_t **prev, node_t **free_block,
     }
 
     *allocated = (Allocation *)temp;
+    **allocated = Allocation();
     (*allocated)->size = size;
-    (*allocated)->marked = false;
 }
 
 /**
@@ -137,23 +352,47 @@ void Heap::coalesce(node_t *free_block) {
         (char *)free_block + free_block->size + sizeof(node_t) 
         == (char *)free_block->next) {
         node_t* second = free_block->next;
+        Heap::index_remove(second);
         free_block->size += second->size + sizeof(node_t);
         free_block->next = second->next;
+        if (rover == second) rover = free_block;
     }
     if (prev &&
         (char *)prev + prev->size + sizeof(node_t) == (char *)free_block) {
+        Heap::index_remove(prev);
         prev->size += free_block->size + sizeof(node_t);
         prev->next = free_block->next;
+        if (rover == free_block) rover = prev;
+        Heap::index_add(prev);
+    } else {
+        Heap::index_add(free_block);
     }
 }
 
 /**
  * Allocates memory from the heap, splitting a free block if possible.
+ * The size is rounded up to a multiple of HEAP_ALIGN so that every block,
+ * and therefore every returned pointer, stays HEAP_ALIGN aligned.
  *
  * @param size Number of bytes to allocate.
  * @return Pointer to the allocated memory block, or NULL if no suitable block is found.
  */
 void *Heap::my_malloc(size_t size) {
+    if (size >= large_threshold) {
+        return Heap::large_malloc(size);
+    }
+    return Heap::free_list_malloc(size);
+}
+
+/**
+ * Allocates from the free list regardless of the large object threshold.
+ *
+ * @param size Number of bytes to allocate.
+ * @return Pointer to the allocated memory block, or NULL if no suitable block is found.
+ */
+void *Heap::free_list_malloc(size_t size) {
+    size = align_size(size);
+
     node_t *previous = NULL;
     node_t *free_block = NULL;
     Allocation *allocated = NULL;
@@ -168,18 +407,696 @@ void *Heap::my_malloc(size_t size) {
     return (void *)((char *)allocated + sizeof(Allocation));
 }
 
+/**
+ * Allocates a batch of equal-sized blocks. Each free block large enough for
+ * at least one object is split once into as many objects as it can hold,
+ * and the remainder is relinked in place of it.
+ *
+ * @param count Number of blocks wanted.
+ * @param size Number of bytes per block.
+ * @param out Output array receiving the allocated pointers.
+ * @return Number of blocks allocated (less than `count` if the heap filled up).
+ */
+size_t Heap::my_malloc_n(size_t count, size_t size, void **out) {
+    size = align_size(size);
+    size_t actual_size = size + sizeof(Allocation);
+    size_t done = 0;
+    node_t *prev = NULL;
+    node_t *curr = Heap::start();
+
+    while (done < count && curr != tail) {
+        size_t fit = curr->size / actual_size;
+        if (fit == 0) {
+            prev = curr;
+            curr = curr->next;
+            continue;
+        }
+        if (fit > count - done) {
+            fit = count - done;
+        }
+
+        char *block = (char *)curr;
+        size_t original_size = curr->size;
+        node_t *next = curr->next;
+        Heap::index_remove(curr);
+
+        for (size_t i = 0; i < fit; i++) {
+            Allocation *allocated = (Allocation *)(block + i * actual_size);
+            *allocated = Allocation();
+            allocated->size = size;
+            out[done++] = (char *)allocated + sizeof(Allocation);
+        }
+
+        node_t *rest = (node_t *)(block + fit * actual_size);
+        rest->size = original_size - fit * actual_size;
+        rest->next = next;
+        Heap::index_add(rest);
+        if (rover == curr) rover = rest;
+        if (prev == NULL) {
+            this->head = rest;
+        } else {
+            prev->next = rest;
+        }
+
+        prev = rest;
+        curr = next;
+    }
+    return done;
+}
+
+/**
+ * Allocates a block whose payload address is a multiple of `align`. The first
+ * free block that can hold an aligned payload is cut in two: the part before
+ * the payload's header stays on the free list (it must be able to hold a
+ * free node, otherwise the next aligned address is used), and the rest is
+ * split as usual.
+ *
+ * @param size Number of bytes to allocate.
+ * @param align Required alignment; a power of two. Values below HEAP_ALIGN are raised to it.
+ * @return Pointer to the aligned memory, or NULL if no free block can hold it.
+ */
+void *Heap::my_aligned_malloc(size_t size, size_t align) {
+    assert((align & (align - 1)) == 0);
+    if (align <= HEAP_ALIGN) {
+        return Heap::my_malloc(size);
+    }
+    if (size >= large_threshold && align <= (size_t)sysconf(_SC_PAGESIZE)) {
+        return Heap::large_malloc(size, align);
+    }
+    size = align_size(size);
+
+    node_t *prev = NULL;
+    node_t *curr = Heap::start();
+    while (curr != tail) {
+        char *start = (char *)curr + sizeof(Allocation);
+        char *end = (char *)curr + sizeof(node_t) + curr->size;
+        char *payload = (char *)(((uintptr_t)start + align - 1) & ~(uintptr_t)(align - 1));
+        if (payload != start && (size_t)(payload - start) < sizeof(node_t)) {
+            payload += align;
+        }
+
+        if (payload + size <= end) {
+            node_t *block = curr;
+            if (payload != start) {
+                // Leave the leading gap on the free list as its own block
+                Heap::index_remove(curr);
+                block = (node_t *)(payload - sizeof(Allocation));
+                block->size = end - (char *)block - sizeof(node_t);
+                block->next = curr->next;
+                curr->size = (char *)block - (char *)curr - sizeof(node_t);
+                curr->next = block;
+                Heap::index_add(curr);
+                Heap::index_add(block);
+                prev = curr;
+            }
+
+            Allocation *allocated = NULL;
+            Heap::split(size, &prev, &block, &allocated);
+            return (void *)((char *)allocated + sizeof(Allocation));
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+    return NULL;
+}
+
+/**
+ * Maps a dedicated, page-aligned region for a large object and records it
+ * in the sorted large object table. The payload starts `align` bytes into
+ * the mapping, so it is aligned to anything up to the page size.
+ *
+ * @param size Number of bytes to allocate.
+ * @param align Payload alignment; a power of two, at least HEAP_ALIGN and at most the page size.
+ * @return Pointer to the usable memory, or NULL if the mapping fails.
+ */
+void *Heap::large_malloc(size_t size, size_t align) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    assert(align >= HEAP_ALIGN && align <= page && (align & (align - 1)) == 0);
+    size_t length = (size + align + page - 1) / page * page;
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    // The header sits just below the first `align` boundary past the page start
+    char *payload = (char *)base + align;
+    Allocation *allocated = (Allocation *)(payload - sizeof(Allocation));
+    *allocated = Allocation();
+    allocated->size = size;
+    allocated->large = true;
+
+    GC_TRACE_INSTANT(TRACE_LARGE_MALLOC, size, (uintptr_t)payload);
+    large_object large = { (char *)base, length, align };
+    auto pos = lower_bound(large_objects.begin(), large_objects.end(), large,
+                           [](const large_object &a, const large_object &b) { return a.base < b.base; });
+    large_objects.insert(pos, large);
+    return payload;
+}
+
+/**
+ * Finds the large object whose payload is `ptr`: the last mapping starting
+ * at or below it, if the payload offset recorded for it matches.
+ *
+ * @param ptr Pointer to look up.
+ * @return Its entry in the large object table, or end() if it is not one.
+ */
+vector<Heap::large_object>::iterator Heap::find_large_object(void *ptr) {
+    char *p = (char *)ptr;
+    auto pos = upper_bound(large_objects.begin(), large_objects.end(), p,
+                           [](char *a, const large_object &b) { return a < b.base; });
+    if (pos == large_objects.begin() || (pos - 1)->base + (pos - 1)->offset != p) {
+        return large_objects.end();
+    }
+    return pos - 1;
+}
+
+/**
+ * Unmaps a large object if `allocated` is one.
+ *
+ * @param allocated Pointer to the memory block being freed.
+ * @return True if the block was a large object and has been unmapped.
+ */
+bool Heap::large_free(void *allocated) {
+    Allocation *header = (Allocation *)((char *)allocated - sizeof(Allocation));
+    if (!header->large) return false;
+
+    auto pos = Heap::find_large_object(allocated);
+    if (pos == large_objects.end()) {
+        return false;
+    }
+    GC_TRACE_INSTANT(TRACE_LARGE_FREE, (uintptr_t)allocated);
+    munmap(pos->base, pos->length);
+    large_objects.erase(pos);
+    return true;
+}
+
+/**
+ * Tests whether a pointer is the payload of a large object.
+ *
+ * @param ptr Pointer to test.
+ * @return True if `ptr` is a live large object.
+ */
+bool Heap::is_large_object(void *ptr) {
+    return Heap::find_large_object(ptr) != large_objects.end();
+}
+
+/**
+ * Registers a slab size class.
+ *
+ * @param size Payload size of the class.
+ */
+void Heap::add_size_class(size_t size) {
+    size_classes[align_size(size)];
+}
+
+/**
+ * Allocates a slot of the matching size class. Slab pages always come from
+ * the free list, never the large object space. The first slab of the class
+ * with a clear bit in its allocation bitmap supplies the lowest free slot,
+ * found with a count-trailing-zeros on the inverted bitmap.
+ *
+ * @param size Number of bytes requested.
+ * @return Pointer to the payload, or NULL if no slab can serve the request.
+ */
+void *Heap::slab_malloc(size_t size) {
+    auto size_class = size_classes.find(align_size(size));
+    if (size_class == size_classes.end()) {
+        return NULL;
+    }
+    size_t slot_size = size_class->first;
+    vector<slab_t *> &class_slabs = size_class->second;
+
+    slab_t *slab = NULL;
+    for (auto it = class_slabs.rbegin(); it != class_slabs.rend(); ++it) {
+        if (~(*it)->allocated) {
+            slab = *it;
+            break;
+        }
+    }
+
+    if (slab == NULL) {
+        size_t bytes = sizeof(slab_t) + SLAB_SLOTS * (sizeof(Allocation) + slot_size);
+        slab = (slab_t *)Heap::free_list_malloc(bytes);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->slot_size = slot_size;
+        slab->allocated = 0;
+        slab->marked = 0;
+        for (unsigned i = 0; i < SLAB_SLOTS; i++) {
+            Allocation *header = (Allocation *)((char *)slab_payload(slab, i) - sizeof(Allocation));
+            *header = Allocation();
+            header->size = slot_size;
+            header->slab = true;
+        }
+        class_slabs.push_back(slab);
+        slabs.insert(slab);
+    }
+
+    unsigned slot = __builtin_ctzll(~slab->allocated);
+    slab->allocated |= 1ULL << slot;
+    return slab_payload(slab, slot);
+}
+
+/**
+ * Looks up the slab slot containing an address.
+ *
+ * @param ptr Address to look up.
+ * @param slot Output: slot index.
+ * @return The slab, or NULL if `ptr` is not inside an allocated slot.
+ */
+Heap::slab_t *Heap::slab_find(void *ptr, unsigned *slot) {
+    if (slabs.empty()) return NULL;
+
+    auto it = slabs.upper_bound((slab_t *)ptr);
+    if (it == slabs.begin()) return NULL;
+    slab_t *slab = *--it;
+
+    char *first = (char *)slab + sizeof(slab_t);
+    size_t stride = sizeof(Allocation) + slab->slot_size;
+    if ((char *)ptr < first || (char *)ptr >= first + SLAB_SLOTS * stride) {
+        return NULL;
+    }
+    *slot = ((char *)ptr - first) / stride;
+    if (!(slab->allocated & (1ULL << *slot))) {
+        return NULL;
+    }
+    return slab;
+}
+
+/**
+ * Tests whether an address is the start of a live slab object.
+ *
+ * @param ptr Address to test.
+ * @return True for the payload address of an allocated slot.
+ */
+bool Heap::is_slab_object(void *ptr) {
+    unsigned slot;
+    slab_t *slab = Heap::slab_find(ptr, &slot);
+    return slab && slab_payload(slab, slot) == ptr;
+}
+
+/**
+ * Frees a slab slot. The slab itself stays carved until the next sweep
+ * finds it empty, so alternating malloc/free does not churn slab pages.
+ *
+ * @param ptr Payload address of the slot.
+ * @return True if `ptr` was a slab object.
+ */
+bool Heap::slab_free(void *ptr) {
+    if (!((Allocation *)((char *)ptr - sizeof(Allocation)))->slab) return false;
+
+    unsigned slot;
+    slab_t *slab = Heap::slab_find(ptr, &slot);
+    if (!slab || slab_payload(slab, slot) != ptr) {
+        return false;
+    }
+    slab->allocated &= ~(1ULL << slot);
+    return true;
+}
+
+/**
+ * Clears the mark bitmaps before a mark phase.
+ */
+void Heap::slab_clear_marks() {
+    for (slab_t *slab : slabs) {
+        slab->marked = 0;
+    }
+}
+
+/**
+ * Lists the allocated slots of every slab. `slabs` is ordered by address
+ * and slots are laid out in bit order, so the result is sorted.
+ *
+ * @param objects Output: payload addresses of the allocated slots.
+ */
+void Heap::slab_objects(vector<void*> &objects) {
+    for (slab_t *slab : slabs) {
+        uint64_t live = slab->allocated;
+        while (live) {
+            objects.push_back(slab_payload(slab, __builtin_ctzll(live)));
+            live &= live - 1;
+        }
+    }
+}
+
+/**
+ * Sweeps all slabs: the dead slots of a slab are `allocated & ~marked`,
+ * and the survivors are kept with a single AND. Empty slabs are unlinked
+ * from their class and returned to the free list.
+ *
+ * @param freed Output: payload addresses of the freed slots.
+ */
+void Heap::slab_sweep(vector<void*> &freed) {
+    vector<void*> empty;
+    for (auto &size_class : size_classes) {
+        vector<slab_t *> &class_slabs = size_class.second;
+        size_t kept = 0;
+        for (slab_t *slab : class_slabs) {
+            uint64_t dead = slab->allocated & ~slab->marked;
+            slab->allocated &= slab->marked;
+            slab->marked = 0;
+            while (dead) {
+                unsigned slot = __builtin_ctzll(dead);
+                freed.push_back(slab_payload(slab, slot));
+                dead &= dead - 1;
+            }
+
+            if (slab->allocated == 0) {
+                slabs.erase(slab);
+                empty.push_back(slab);
+            } else {
+                class_slabs[kept++] = slab;
+            }
+        }
+        class_slabs.resize(kept);
+    }
+    Heap::free_many(empty.data(), empty.size());
+}
+
 /**
  * Frees a previously allocated block and coalesces it into the free list.
  *
  * @param allocated Pointer to the memory block to free (as returned by my_malloc).
  */
 void Heap::my_free(void *allocated) {
+    if (Heap::large_free(allocated) || Heap::slab_free(allocated)) {
+        return;
+    }
+
     Allocation *header = (Allocation *)((char *)allocated - sizeof(Allocation));
     node_t *free_node = (node_t *)header;
-    free_node->size = header->size;
+    free_node->size = header->size + sizeof(Allocation) - sizeof(node_t);
     Heap::coalesce(free_node);
 }
 
+/**
+ * Frees many blocks at once. After sorting, the freed blocks and the existing
+ * free list are both in address order, so they are merged like two sorted
+ * lists while adjacent blocks are folded together as they are appended.
+ * A block listed more than once is freed once.
+ *
+ * @param blocks Pointers to the memory blocks to free; sorted in place.
+ * @param n Number of blocks.
+ */
+void Heap::free_many(void **blocks, size_t n) {
+    sort(blocks, blocks + n);
+    n = unique(blocks, blocks + n) - blocks;
+
+    // Large and slab objects are released directly and dropped from the batch
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!Heap::large_free(blocks[i]) && !Heap::slab_free(blocks[i])) {
+            blocks[kept++] = blocks[i];
+        }
+    }
+    n = kept;
+
+    if (n == 0) return;
+    GC_TRACE_INSTANT(TRACE_FREE_MANY, n);
+
+    node_t *curr = Heap::start();
+    node_t *new_head = NULL;
+    node_t *last = NULL;
+    size_t i = 0;
+
+    while (curr != tail || i < n) {
+        node_t *block;
+        if (i < n && (curr == tail || (char *)blocks[i] - sizeof(Allocation) < (char *)curr)) {
+            Allocation *header = (Allocation *)((char *)blocks[i] - sizeof(Allocation));
+            block = (node_t *)header;
+            block->size = header->size + sizeof(Allocation) - sizeof(node_t);
+            i++;
+        } else {
+            block = curr;
+            curr = curr->next;
+        }
+
+        if (last && (char *)last + last->size + sizeof(node_t) == (char *)block) {
+            last->size += block->size + sizeof(node_t);
+        } else {
+            if (last) {
+                last->next = block;
+            } else {
+                new_head = block;
+            }
+            last = block;
+        }
+    }
+
+    last->next = tail;
+    this->head = new_head;
+    rover = NULL;
+    Heap::index_rebuild();
+}
+
+/**
+ * Selects the placement policy, building the free block trees when switching
+ * to best-fit and dropping them otherwise.
+ *
+ * @param policy The policy to use from now on.
+ */
+void Heap::set_policy(alloc_policy_t policy) {
+    this->policy = policy;
+    rover = NULL;
+    Heap::index_rebuild();
+}
+
+/**
+ * Adds a free block to the free space counters and, under BEST_FIT, to the
+ * best-fit trees. Must be called after the block's size is final.
+ *
+ * @param block The free block.
+ */
+void Heap::index_add(node_t *block) {
+    free_bytes += block->size;
+    free_blocks++;
+    free_sizes[block->size]++;
+
+    if (policy != BEST_FIT) return;
+    free_by_size.insert(make_pair(block->size, block));
+    free_by_addr.insert(block);
+}
+
+/**
+ * Removes a free block from the free space counters and, under BEST_FIT,
+ * from the best-fit trees. Must be called before the block's size changes.
+ *
+ * @param block The free block.
+ */
+void Heap::index_remove(node_t *block) {
+    free_bytes -= block->size;
+    free_blocks--;
+    auto count = free_sizes.find(block->size);
+    assert(count != free_sizes.end());
+    if (--count->second == 0) {
+        free_sizes.erase(count);
+    }
+
+    if (policy != BEST_FIT) return;
+    free_by_size.erase(make_pair(block->size, block));
+    free_by_addr.erase(block);
+}
+
+/**
+ * Rebuilds the counters and best-fit trees from the free list after a bulk
+ * change. This is the only walk; readers of the counters never pay for one.
+ */
+void Heap::index_rebuild() {
+    free_by_size.clear();
+    free_by_addr.clear();
+    free_sizes.clear();
+    free_bytes = 0;
+    free_blocks = 0;
+    if (this->head == NULL) return;
+    for (node_t *p = this->head; p != tail; p = p->next) {
+        free_bytes += p->size;
+        free_blocks++;
+        free_sizes[p->size]++;
+        if (policy == BEST_FIT) {
+            free_by_size.insert(make_pair(p->size, p));
+            free_by_addr.insert(free_by_addr.end(), p);
+        }
+    }
+}
+
+/**
+ * Returns the pages of free blocks to the OS with madvise(MADV_DONTNEED).
+ * MADV_DONTNEED is used rather than MADV_FREE so that RSS drops right away.
+ * Only whole pages strictly inside a free block are released; the node
+ * header at the start of each block stays resident so the free list can
+ * still be walked. The first `scavenge_retain` bytes of free memory, in
+ * address order, are kept because first-fit reuses them soonest. Released
+ * pages read back as zeroes and are faulted in again when reused.
+ *
+ * @return Number of bytes released by this call.
+ */
+size_t Heap::scavenge() {
+    if (scavenge_retain == SIZE_MAX || this->heap_base == NULL) {
+        return 0;
+    }
+    GC_TRACE_BEGIN(TRACE_SCAVENGE);
+
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    size_t retained = 0;
+    size_t released = 0;
+
+    for (node_t *p = this->head; p != tail; p = p->next) {
+        size_t keep = min(scavenge_retain - retained, p->size);
+        retained += keep;
+
+        uintptr_t data = (uintptr_t)p + sizeof(node_t);
+        uintptr_t start = (data + keep + page - 1) & ~(page - 1);
+        uintptr_t end = (data + p->size) & ~(page - 1);
+        if (start < end && madvise((void *)start, end - start, MADV_DONTNEED) == 0) {
+            released += end - start;
+        }
+    }
+    GC_TRACE_END(TRACE_SCAVENGE, released);
+    return released;
+}
+
+/**
+ * Verifies the heap in four passes: the free list and its counters, a
+ * physical walk that must tile the arena with free and allocated blocks,
+ * the slabs, and the large object table. Stops at the first problem.
+ *
+ * @param error Optional output describing the first inconsistency.
+ * @param blocks Optional output: payloads of the allocated blocks.
+ * @return True if no inconsistency was found.
+ */
+bool Heap::verify(string *error, vector<void*> *blocks) {
+    char message[160];
+    auto fail = [&](const char *format, const void *where, size_t value) {
+        snprintf(message, sizeof(message), format, where, value);
+        if (error) *error = message;
+        return false;
+    };
+
+    if (this->tail == NULL) {
+        return true; // Never started: nothing to check
+    }
+    char *first = this->heap_base + HEAP_ALIGN - sizeof(Allocation);
+    if ((char *)this->tail != this->heap_base + heap_size || tail->size != 0 || tail->next != NULL) {
+        return fail("tail sentinel %p is corrupt (size %zu)", tail, tail->size);
+    }
+
+    // Free list: in bounds, aligned, ascending, coalesced, and matching the counters
+    size_t bytes = 0;
+    size_t count = 0;
+    size_t limit = (heap_size / sizeof(node_t)) + 1; // More blocks than this means a cycle
+    bool rover_found = rover == NULL;
+    map<size_t, size_t> sizes;
+    for (node_t *p = this->head; p != tail; p = p->next) {
+        if ((char *)p < first || (char *)p >= (char *)tail || ++count > limit) {
+            return fail("free block %p is outside the heap (block %zu)", p, count);
+        }
+        if (((uintptr_t)p + sizeof(Allocation)) % HEAP_ALIGN) {
+            return fail("free block %p is misaligned (size %zu)", p, p->size);
+        }
+        char *end = (char *)p + sizeof(node_t) + p->size;
+        if (end > (char *)tail || (p->next != tail && (char *)p->next < end)) {
+            return fail("free block %p overlaps the next one (size %zu)", p, p->size);
+        }
+        if (p->next != tail && (char *)p->next == end) {
+            return fail("free block %p is not coalesced with its neighbour (size %zu)", p, p->size);
+        }
+        bytes += p->size;
+        sizes[p->size]++;
+        if (p == rover) rover_found = true;
+        if (policy == BEST_FIT && (!free_by_addr.count(p) || !free_by_size.count(make_pair(p->size, p)))) {
+            return fail("free block %p is missing from the best-fit trees (size %zu)", p, p->size);
+        }
+    }
+    if (bytes != free_bytes || count != free_blocks || sizes != free_sizes) {
+        return fail("free space counters disagree with the free list at %p (%zu bytes counted)", head, bytes);
+    }
+    if (policy == BEST_FIT ? free_by_addr.size() != count || free_by_size.size() != count
+                           : !free_by_addr.empty() || !free_by_size.empty()) {
+        return fail("best-fit trees disagree with the free list at %p (%zu blocks)", head, count);
+    }
+    if (!rover_found) {
+        return fail("next-fit rover %p is not a free block (%zu blocks)", rover, count);
+    }
+
+    // Physical walk: every block starts just below a HEAP_ALIGN boundary and
+    // the last one ends exactly at the tail
+    vector<void*> allocated;
+    node_t *next_free = this->head;
+    char *cursor = first;
+    while (cursor < (char *)tail) {
+        if (((uintptr_t)cursor + sizeof(Allocation)) % HEAP_ALIGN) {
+            return fail("block at %p is misaligned (%zu bytes into the heap)", cursor, cursor - first);
+        }
+        if (cursor == (char *)next_free) {
+            cursor += sizeof(node_t) + next_free->size;
+            next_free = next_free->next;
+            continue;
+        }
+        Allocation *header = (Allocation *)cursor;
+        char *limit_end = (char *)next_free; // The next free block, or the tail
+        if (header->large || header->slab || cursor + sizeof(Allocation) + header->size > limit_end) {
+            return fail("allocated block %p has a corrupt header (size %zu)", cursor + sizeof(Allocation),
+                        (size_t)header->size);
+        }
+        allocated.push_back(cursor + sizeof(Allocation));
+        cursor += sizeof(Allocation) + header->size;
+    }
+    if (cursor != (char *)tail) {
+        return fail("blocks overrun the tail sentinel at %p by %zu bytes", tail, cursor - (char *)tail);
+    }
+    size_t arena = heap_size - (HEAP_ALIGN - sizeof(Allocation));
+    if (used_memory() + free_bytes + free_blocks * sizeof(node_t) != arena) {
+        return fail("used and free memory do not add up to the arena at %p (%zu used)", first, used_memory());
+    }
+
+    // Slabs: each is an allocated block registered once under its size class
+    size_t class_slabs = 0;
+    for (auto &size_class : size_classes) {
+        for (slab_t *slab : size_class.second) {
+            if (!slabs.count(slab) || slab->slot_size != size_class.first) {
+                return fail("slab %p is in the wrong size class (%zu)", slab, size_class.first);
+            }
+            class_slabs++;
+        }
+    }
+    if (class_slabs != slabs.size()) {
+        return fail("slab set and size classes disagree at %p (%zu listed)", head, class_slabs);
+    }
+    for (slab_t *slab : slabs) {
+        if (!binary_search(allocated.begin(), allocated.end(), (void *)slab) ||
+            ((Allocation *)((char *)slab - sizeof(Allocation)))->size <
+                sizeof(slab_t) + SLAB_SLOTS * (sizeof(Allocation) + slab->slot_size)) {
+            return fail("slab %p is not an allocated block (slot size %zu)", slab, slab->slot_size);
+        }
+        if (slab->marked & ~slab->allocated) {
+            return fail("slab %p marks free slots (%zu)", slab, (size_t)(slab->marked & ~slab->allocated));
+        }
+        for (unsigned slot = 0; slot < SLAB_SLOTS; slot++) {
+            Allocation *header = (Allocation *)((char *)slab_payload(slab, slot) - sizeof(Allocation));
+            if (!header->slab || header->size != slab->slot_size) {
+                return fail("slab %p has a corrupt slot header (slot %zu)", slab, slot);
+            }
+        }
+    }
+
+    // Large objects: sorted, disjoint mappings with a large header
+    for (size_t i = 0; i < large_objects.size(); i++) {
+        large_object &large = large_objects[i];
+        Allocation *header = (Allocation *)(large.base + large.offset - sizeof(Allocation));
+        if (!header->large || header->size + large.offset > large.length ||
+            (i > 0 && large_objects[i - 1].base + large_objects[i - 1].length > large.base)) {
+            return fail("large object %p is corrupt (mapping of %zu bytes)", large.base + large.offset,
+                        large.length);
+        }
+    }
+
+    if (blocks) {
+        blocks->swap(allocated);
+    }
+    return true;
+}
+
 /**
  * Prints the current free list, showing the sizes of free blocks.
  */
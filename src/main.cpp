@@ -1,148 +1,414 @@
 #include <iostream>
+#include <fstream>
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <string.h>
+#include <algorithm>
 #include <gc.h>
 #include <heap.h>
+#include <profiler.h>
 #include <limits>
 #include <sstream>
 
 using namespace std;
 
-void print_help() {
-    cout << "\nAvailable commands:\n"
-         << "  alloc <name> <size>        - Allocate object\n"
-         << "  ref <from> [to]            - Add external (or nested if 'to' is given) reference\n"
-         << "  delref <name>              - Delete external reference\n"
-         << "  rc                         - Run reference counting GC\n"
-         << "  ms                         - Run mark-and-sweep GC\n"
-         << "  mem                        - Show available memory\n"
-         << "  list                       - List current objects\n"
-         << "  help                       - Show this help menu\n"
-         << "  exit                       - Quit the program\n";
+void print_help(ostream &out) {
+    out << "\nAvailable commands (one per line; a line starting with '#' is a comment):\n"
+        << "  alloc <name> <size>        - Allocate object\n"
+        << "  ref <from> [to] [field]    - Add external (or nested if 'to' is given) reference\n"
+        << "  delref <name>              - Delete external reference\n"
+        << "  rc                         - Run reference counting GC\n"
+        << "  ms                         - Run mark-and-sweep GC\n"
+        << "  mem                        - Show available memory\n"
+        << "  stats                      - Show collector statistics\n"
+        << "  record <file|off>          - Start or stop recording an allocation trace\n"
+        << "  snapshot <file>            - Write a heap snapshot for gc_snapshot\n"
+        << "  profile <on [rate]|off|report|write <file>> - Sample allocation sites\n"
+        << "  verify                     - Check heap and collector integrity\n"
+        << "  gcpercent <n|off>          - Collect automatically once allocation reaches n% of live memory\n"
+        << "  list                       - List current objects\n"
+        << "  help                       - Show this help menu\n"
+        << "  exit                       - Quit the program\n";
 }
 
-int main() {
-    cout << "==== Interactive Garbage Collection Simulator ====" << endl;
-    print_help();
+void print_usage(const char *name) {
+    cerr << "Usage: " << name << " [--batch [script|-]] [--quiet] [--heap BYTES] [--max-heap BYTES]\n"
+         << "  --batch     Run the commands of a script (default: stdin) without prompts\n"
+         << "  --quiet     In batch mode, only print the final summary\n"
+         << "  --heap      Size of the heap (default " << HEAP_SIZE << ")\n"
+         << "  --max-heap  Size the pacer may grow the heap to (default: --heap)\n";
+}
 
+/**
+ * The simulator's state: the heap, the collector and the named objects.
+ * Names map to pointers for commands, and pointers map back to names so
+ * that each pointer a collection frees is unnamed in constant time.
+ */
+struct Simulator {
     Heap heap;
     GarbageCollector gc;
 
-    unordered_map<string, void*> objects;
+    Simulator(size_t heap_size, size_t max_heap_size) : heap(heap_size) {
+        heap.max_heap_size = max_heap_size;
+        // Collections the pacer runs inside malloc() free named objects too
+        gc.set_collection_hook([this](const list<void*> &deleted) { forget(deleted); });
+    }
 
-    string command;
-    while (true) {
+    unordered_map<string, void*> objects;
+    unordered_map<void*, string> names;
 
-        cout << "\n> ";
-        cin >> command;
-
-        if (command == "alloc") {
-            string name;
-            size_t size;
-            cin >> name >> size;
-        
-            if (cin.fail()) {
-                cout << "Invalid input. Usage: alloc <name> <size>" << endl;
-                cin.clear();               // clear the fail state
-                cin.ignore(10000, '\n');   // discard the rest of the line
-                continue;
+    /**
+     * Forgets the names of objects freed by a collection.
+     * @param deleted Pointers freed by a collection, from the collection hook.
+     */
+    void forget(const list<void*> &deleted) {
+        for (void *ptr : deleted) {
+            auto name = names.find(ptr);
+            if (name != names.end()) {
+                objects.erase(name->second);
+                names.erase(name);
             }
-        
-            if (objects.find(name) != objects.end()) {
-                cout << "Objects must have unique names." << endl;
+        }
+    }
+};
+
+/**
+ * Time spent per command word, for the batch summary.
+ */
+struct CommandStats {
+    size_t count = 0;
+    uint64_t ns = 0;
+};
+
+/**
+ * Splits a line into whitespace separated tokens without copying it.
+ *
+ * @param line The line.
+ * @param tokens Output array.
+ * @param max Size of `tokens`; further tokens are ignored.
+ * @return Number of tokens found.
+ */
+static size_t tokenize(string_view line, string_view *tokens, size_t max) {
+    size_t n = 0;
+    size_t pos = 0;
+    while (n < max) {
+        pos = line.find_first_not_of(" \t\r", pos);
+        if (pos == string_view::npos) break;
+        size_t end = line.find_first_of(" \t\r", pos);
+        if (end == string_view::npos) end = line.size();
+        tokens[n++] = line.substr(pos, end - pos);
+        pos = end;
+    }
+    return n;
+}
+
+/**
+ * Runs one command line. Output lines end in '\n' rather than endl, so
+ * nothing is flushed per command: interactive mode relies on cin being tied
+ * to cout, and batch mode writes through the stream buffer.
+ *
+ * @param sim The simulator state.
+ * @param line The command line.
+ * @param out Where command output goes.
+ * @param command Output: the command word, empty for a blank or comment line.
+ * @return False once the command is `exit`.
+ */
+static bool run_command(Simulator &sim, string_view line, ostream &out, string_view *command) {
+    string_view args[4];
+    size_t n = tokenize(line, args, 4);
+    if (n == 0 || args[0][0] == '#') {
+        *command = string_view(); // Blank line or script comment
+        return true;
+    }
+    *command = args[0];
+
+    string_view cmd = args[0];
+    if (cmd == "alloc") {
+        if (n != 3 || args[2].find_first_not_of("0123456789") != string_view::npos) {
+            out << "Invalid input. Usage: alloc <name> <size>\n";
+            return true;
+        }
+        string name(args[1]);
+        size_t size = strtoull(string(args[2]).c_str(), NULL, 10);
+
+        if (sim.objects.find(name) != sim.objects.end()) {
+            out << "Objects must have unique names.\n";
+        } else {
+            void* ptr = sim.gc.malloc(size, &sim.heap);
+            if (ptr) {
+                sim.objects[name] = ptr;
+                sim.names[ptr] = name;
+                out << "Allocated '" << name << "' with " << size << " bytes.\n";
             } else {
-                void* ptr = gc.malloc(size, &heap);
-                if (ptr) {
-                    objects[name] = ptr;
-                    cout << "Allocated '" << name << "' with " << size << " bytes." << endl;
-                } else {
-                    cout << "Allocation failed." << endl;
-                }
+                out << "Allocation failed.\n";
             }
+        }
 
-        } else if (command == "ref") {
-            string line;
-            getline(cin >> ws, line); // read the rest of the line, trimming leading whitespace
-            istringstream iss(line);
-            string from, to;
-            iss >> from >> to;
-
-            if (!from.empty() && to.empty()) {
-                if (objects.count(from)) {
-                    gc.add_reference(objects[from]);
-                    cout << "Added external reference to '" << from << "'." << endl;
-                } else {
-                    cout << "Unknown object: " << from << endl;
-                }
-            } else if (!from.empty() && !to.empty()) {
-                if (objects.count(from) && objects.count(to)) {
-                    gc.add_nested_reference(objects[from], objects[to]);
-                    cout << "Added nested reference: " << from << " → " << to << endl;
+    } else if (cmd == "ref") {
+        if (n == 2) {
+            auto from = sim.objects.find(string(args[1]));
+            if (from != sim.objects.end()) {
+                sim.gc.add_reference(from->second);
+                out << "Added external reference to '" << args[1] << "'.\n";
+            } else {
+                out << "Unknown object: " << args[1] << "\n";
+            }
+        } else if (n > 2) {
+            auto from = sim.objects.find(string(args[1]));
+            auto to = sim.objects.find(string(args[2]));
+            size_t field = n > 3 ? strtoull(string(args[3]).c_str(), NULL, 10) : 0;
+            if (from != sim.objects.end() && to != sim.objects.end()) {
+                if (sim.gc.add_nested_reference(from->second, to->second, field) == 0) {
+                    out << "Added nested reference: " << args[1] << " → " << args[2] << "\n";
                 } else {
-                    cout << "Unknown object names." << endl;
+                    out << "Field " << field << " is outside '" << args[1] << "'.\n";
                 }
             } else {
-                cout << "Usage: ref <from> [to]" << endl;
+                out << "Unknown object names.\n";
             }
+        } else {
+            out << "Usage: ref <from> [to] [field]\n";
+        }
 
-        } else if (command == "delref") {
-            string name;
-            cin >> name;
-            if (objects.count(name)) {
-                gc.delete_reference(objects[name]);
-                cout << "Deleted external reference to '" << name << "'" << endl;
-            } else {
-                cout << "Unknown object: " << name << endl;
-            }
+    } else if (cmd == "delref") {
+        string name(n > 1 ? args[1] : string_view());
+        auto object = sim.objects.find(name);
+        if (object != sim.objects.end()) {
+            sim.gc.delete_reference(object->second);
+            out << "Deleted external reference to '" << name << "'\n";
+        } else {
+            out << "Unknown object: " << name << "\n";
+        }
 
-        } else if (command == "rc") {
-            list<void*> deleted_ptrs = gc.rc_collect(&heap);
-            for (auto ptr : deleted_ptrs) {
-                for (auto it = objects.begin(); it != objects.end(); ) {
-                    if (it->second == ptr) {
-                        it = objects.erase(it);
-                    } else {
-                        ++it;
-                    }
-                }
-            }
-            cout << "Reference counting GC completed." << endl;
-
-        } else if (command == "ms") {
-            list<void*> deleted_ptrs = gc.ms_collect(&heap);
-            for (auto ptr : deleted_ptrs) {
-                for (auto it = objects.begin(); it != objects.end(); ) {
-                    if (it->second == ptr) {
-                        it = objects.erase(it);
-                    } else {
-                        ++it;
-                    }
-                }
-            }
-            cout << "Mark and sweep GC completed." << endl;
+    } else if (cmd == "rc") {
+        sim.gc.rc_collect(&sim.heap);
+        out << "Reference counting GC completed.\n";
+
+    } else if (cmd == "ms") {
+        sim.gc.ms_collect(&sim.heap);
+        out << "Mark and sweep GC completed.\n";
+
+    } else if (cmd == "mem") {
+        out << "Available memory: " << sim.heap.available_memory() << " bytes.\n";
+        out << "Heap size: " << sim.heap.heap_size << " of at most " << sim.heap.max_size() << " bytes\n";
+        out << "Free blocks: " << sim.heap.free_block_count()
+            << ", largest: " << sim.heap.largest_free_block()
+            << " bytes, fragmentation: " << sim.heap.fragmentation() << "\n";
+
+    } else if (cmd == "stats") {
+        const GcStats& last = sim.gc.last_stats();
+        const GcTotals& totals = sim.gc.total_stats();
+        out << "Collections: " << totals.collections << " (" << totals.ms_collections
+            << " mark-and-sweep, " << totals.rc_collections << " reference counting)\n";
+        out << "Freed: " << totals.objects_freed << " objects, " << totals.bytes_freed << " bytes\n";
+        out << "Pause (ns): mean " << totals.pause_ns.mean() << ", p99 <= "
+            << totals.pause_ns.quantile(0.99) << ", max " << totals.pause_ns.max << "\n";
+        out << "Last cycle (ns): clear " << last.clear_ns << ", roots " << last.root_scan_ns
+            << ", mark " << last.mark_ns << ", sweep " << last.sweep_ns
+            << ", coalesce " << last.coalesce_ns << "\n";
+        out << "Last cycle: " << last.objects_marked << " marked, " << last.objects_freed
+            << " freed, " << last.words_scanned << " words scanned\n";
+
+    } else if (cmd == "record") {
+        string path(n > 1 ? args[1] : string_view());
+        if (path == "off") {
+            out << (sim.gc.stop_recording() ? "Recording stopped." : "Recording failed to write.") << "\n";
+        } else if (!path.empty() && sim.gc.start_recording(path.c_str())) {
+            out << "Recording to '" << path << "'.\n";
+        } else {
+            out << "Cannot write " << path << "\n";
+        }
 
-        } else if (command == "mem") {
-            cout << "Available memory: " << heap.available_memory() << " bytes." << endl;
+    } else if (cmd == "snapshot") {
+        string path(n > 1 ? args[1] : string_view());
+        if (!path.empty() && sim.gc.dump_snapshot(path.c_str(), &sim.heap)) {
+            out << "Snapshot written to '" << path << "'.\n";
+        } else {
+            out << "Cannot write " << path << "\n";
+        }
 
-        } else if (command == "list") {
-            cout << "Tracked objects:" << endl;
-            for (const auto& [name, ptr] : objects) {
-                cout << "  " << name << ": " << ptr << endl;
+    } else if (cmd == "profile") {
+        string mode(n > 1 ? args[1] : string_view());
+        const AllocationProfiler *profile = sim.gc.allocation_profile();
+        if (mode == "on") {
+            size_t rate = n > 2 ? strtoull(string(args[2]).c_str(), NULL, 0) : PROFILE_SAMPLE_RATE;
+            sim.gc.start_profiling(rate);
+            out << "Sampling every ~" << sim.gc.allocation_profile()->rate() << " bytes.\n";
+        } else if (mode == "off") {
+            sim.gc.stop_profiling();
+            out << "Profiling stopped.\n";
+        } else if (profile == NULL && (mode == "report" || mode == "write")) {
+            out << "Not profiling. Use 'profile on' first.\n";
+        } else if (mode == "report") {
+            profile->report(out, 10);
+        } else if (mode == "write" && n > 2) {
+            string path(args[2]);
+            if (profile->write_pprof(path.c_str())) {
+                out << "Profile written to '" << path << "'.\n";
+            } else {
+                out << "Cannot write " << path << "\n";
             }
+        } else {
+            out << "Usage: profile <on [rate]|off|report|write <file>>\n";
+        }
 
-        } else if (command == "exit") {
-            cout << "Exiting garbage collection simulator." << endl;
-            break;
-        
-        } else if (command == "help") {
-            print_help();
+    } else if (cmd == "gcpercent") {
+        string value(n > 1 ? args[1] : string_view());
+        if (value == "off") {
+            sim.gc.set_gc_percent(-1);
+            out << "Automatic collection off.\n";
+        } else if (!value.empty() && value.find_first_not_of("0123456789") == string::npos) {
+            sim.gc.set_gc_percent(atoi(value.c_str()));
+            out << "Next collection after " << sim.gc.next_collection() << " bytes; heap "
+                << sim.heap.heap_size << " of at most " << sim.heap.max_size() << " bytes.\n";
+        } else {
+            out << "Usage: gcpercent <n|off>\n";
+        }
 
+    } else if (cmd == "verify") {
+        string error;
+        if (sim.gc.verify(&sim.heap, &error)) {
+            out << "Heap is consistent.\n";
         } else {
-            cout << "Unknown command. Try again." << endl;
-            // Flush the rest of the line to prevent input errors
-            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            out << "Heap is corrupt: " << error << "\n";
         }
+
+    } else if (cmd == "list") {
+        out << "Tracked objects:\n";
+        for (const auto& [name, ptr] : sim.objects) {
+            out << "  " << name << ": " << ptr << "\n";
+        }
+
+    } else if (cmd == "exit") {
+        out << "Exiting garbage collection simulator.\n";
+        return false;
+
+    } else if (cmd == "help") {
+        print_help(out);
+
+    } else {
+        out << "Unknown command. Try again.\n";
     }
+    return true;
+}
+
+/**
+ * Interactive mode: one prompt per command line.
+ *
+ * @param sim The simulator state.
+ */
+static int run_interactive(Simulator &sim) {
+    cout << "==== Interactive Garbage Collection Simulator ====" << endl;
+    print_help(cout);
 
+    string line;
+    string_view command;
+    while (true) {
+        cout << "\n> ";
+        if (!getline(cin, line)) break;
+        if (!run_command(sim, line, cout, &command)) break;
+    }
     return 0;
 }
+
+/**
+ * Batch mode: the whole script is read at once, then executed line by line
+ * with buffered output. A summary with per-command timings follows.
+ *
+ * @param sim The simulator state.
+ * @param path Script file, or "-" for stdin.
+ * @param quiet Drop per-command output.
+ */
+static int run_batch(Simulator &sim, const char *path, bool quiet) {
+    ios::sync_with_stdio(false);
+    cin.tie(NULL);
+
+    string script;
+    if (strcmp(path, "-") == 0) {
+        script.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+    } else {
+        ifstream in(path, ios::binary);
+        if (!in) {
+            cerr << "Cannot read script: " << path << "\n";
+            return 1;
+        }
+        script.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+
+    ostream discard(NULL); // No buffer: everything written is dropped
+    ostream &out = quiet ? discard : cout;
+
+    unordered_map<string, CommandStats> per_command;
+    size_t lines = 0;
+    uint64_t start = gc_now_ns();
+    string_view text(script);
+    string_view command;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == string_view::npos) end = text.size();
+        string_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+        lines++;
+
+        uint64_t before = gc_now_ns();
+        bool more = run_command(sim, line, out, &command);
+        if (!command.empty()) {
+            CommandStats &stats = per_command[string(command)];
+            stats.count++;
+            stats.ns += gc_now_ns() - before;
+        }
+        if (!more) break;
+    }
+    uint64_t elapsed = gc_now_ns() - start;
+
+    vector<pair<string, CommandStats>> sorted(per_command.begin(), per_command.end());
+    sort(sorted.begin(), sorted.end(),
+         [](const pair<string, CommandStats> &a, const pair<string, CommandStats> &b) { return a.first < b.first; });
+
+    cout << "==== Batch summary ====\n";
+    cout << "Lines: " << lines << ", time: " << elapsed / 1e6 << " ms\n";
+    for (const auto& [name, stats] : sorted) {
+        cout << "  " << name << ": " << stats.count << " commands, " << stats.ns / 1e6 << " ms ("
+             << (double)stats.ns / stats.count << " ns each)\n";
+    }
+    const GcTotals &totals = sim.gc.total_stats();
+    cout << "Live objects: " << sim.objects.size() << "\n";
+    cout << "Available memory: " << sim.heap.available_memory() << " bytes, fragmentation: "
+         << sim.heap.fragmentation() << "\n";
+    cout << "Collections: " << totals.collections << ", freed " << totals.objects_freed
+         << " objects, pause mean " << totals.pause_ns.mean() << " ns, max "
+         << totals.pause_ns.max << " ns" << endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *script = NULL;
+    bool quiet = false;
+    size_t heap_size = HEAP_SIZE;
+    size_t max_heap_size = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--batch") == 0) {
+            script = "-";
+            if (i + 1 < argc && (argv[i + 1][0] != '-' || argv[i + 1][1] == '\0')) {
+                script = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        } else if (strcmp(argv[i], "--heap") == 0 && i + 1 < argc) {
+            heap_size = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--max-heap") == 0 && i + 1 < argc) {
+            max_heap_size = strtoull(argv[++i], NULL, 0);
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    Simulator sim(heap_size, max_heap_size);
+    if (script) {
+        return run_batch(sim, script, quiet);
+    }
+    return run_interactive(sim);
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <math.h>
+#include <execinfo.h>
+#include <algorithm>
+#include <profiler.h>
+
+/**
+ * Starts the profiler with a fresh countdown.
+ *
+ * @param sample_rate Mean bytes between samples.
+ */
+AllocationProfiler::AllocationProfiler(size_t sample_rate) {
+    this->sample_rate = sample_rate ? sample_rate : 1;
+    random_state = 0x9e3779b97f4a7c15ULL;
+    bytes_until_sample = next_interval();
+}
+
+/**
+ * Draws the bytes until the next sample from an exponential distribution
+ * with mean `sample_rate`, so that every byte is equally likely to be
+ * sampled regardless of allocation sizes. A rate of 1 samples everything.
+ *
+ * @return Bytes to allocate before the next sample.
+ */
+int64_t AllocationProfiler::next_interval() {
+    if (sample_rate == 1) return 0;
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    double uniform = ((random_state >> 11) + 0.5) / (double)(1ULL << 53); // In (0, 1)
+    return (int64_t)(-log(uniform) * sample_rate);
+}
+
+/**
+ * Takes a sample: captures the backtrace, drops the profiler's own frame,
+ * and files the object under the site of that backtrace.
+ *
+ * @param ptr The sampled object.
+ * @param size Its size.
+ */
+__attribute__((noinline))
+void AllocationProfiler::sample(void *ptr, size_t size) {
+    bytes_until_sample = next_interval();
+
+    void *frames[PROFILE_MAX_FRAMES + 1];
+    int depth = backtrace(frames, PROFILE_MAX_FRAMES + 1);
+    vector<void*> stack(frames + (depth > 0 ? 1 : 0), frames + depth);
+
+    auto found = site_index.find(stack);
+    size_t site;
+    if (found == site_index.end()) {
+        site = site_list.size();
+        site_index[stack] = site;
+        site_list.push_back({ stack, 0, 0, 0, 0, 0, 0 });
+    } else {
+        site = found->second;
+    }
+
+    profile_site &entry = site_list[site];
+    entry.alloc_objects++;
+    entry.alloc_bytes += size;
+    entry.live_objects++;
+    entry.live_bytes += size;
+    sampled[ptr] = { site, size, 0 };
+}
+
+/**
+ * Removes a sample's bytes from its site's live totals.
+ *
+ * @param object The freed sample.
+ */
+void AllocationProfiler::release(const sampled_object &object) {
+    profile_site &site = site_list[object.site];
+    site.live_objects--;
+    site.live_bytes -= object.size;
+}
+
+/**
+ * Forgets an explicitly freed sample.
+ *
+ * @param ptr The freed object.
+ */
+void AllocationProfiler::freed(void *ptr) {
+    auto object = sampled.find(ptr);
+    if (object == sampled.end()) return;
+    release(object->second);
+    sampled.erase(object);
+}
+
+/**
+ * Accounts for a collection. Victims that never survived a collection are
+ * counted as dying young; every remaining sample survived this one.
+ *
+ * @param deleted Objects the collection freed.
+ */
+void AllocationProfiler::collected(const list<void*> &deleted) {
+    for (void *ptr : deleted) {
+        auto object = sampled.find(ptr);
+        if (object == sampled.end()) continue;
+        if (object->second.collections == 0) {
+            site_list[object->second.site].freed_young++;
+        }
+        release(object->second);
+        sampled.erase(object);
+    }
+    for (auto &object : sampled) {
+        if (object.second.collections++ == 0) {
+            site_list[object.second.site].survived++;
+        }
+    }
+}
+
+/**
+ * Writes a gperftools-style heap profile:
+ *
+ *     heap profile: <live objs>: <live bytes> [<alloc objs>: <alloc bytes>] @ heap_v2/<rate>
+ *     <live objs>: <live bytes> [<alloc objs>: <alloc bytes>] @ <frame> <frame> ...
+ *     MAPPED_LIBRARIES:
+ *     <copy of /proc/self/maps>
+ *
+ * @param path File to create.
+ * @return True if the profile was written.
+ */
+bool AllocationProfiler::write_pprof(const char *path) const {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    size_t live_objects = 0, live_bytes = 0, alloc_objects = 0, alloc_bytes = 0;
+    for (const profile_site &site : site_list) {
+        live_objects += site.live_objects;
+        live_bytes += site.live_bytes;
+        alloc_objects += site.alloc_objects;
+        alloc_bytes += site.alloc_bytes;
+    }
+    fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            live_objects, live_bytes, alloc_objects, alloc_bytes, sample_rate);
+    for (const profile_site &site : site_list) {
+        fprintf(file, "%zu: %zu [%zu: %zu] @", site.live_objects, site.live_bytes,
+                site.alloc_objects, site.alloc_bytes);
+        for (void *frame : site.frames) {
+            fprintf(file, " %p", frame);
+        }
+        fprintf(file, "\n");
+    }
+
+    fprintf(file, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), maps)) > 0) {
+            fwrite(buffer, 1, n, file);
+        }
+        fclose(maps);
+    }
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * Prints the sites with the most sampled bytes, symbolized with
+ * backtrace_symbols() (link with -rdynamic for function names).
+ *
+ * @param out Stream to write to.
+ * @param top Number of sites to print.
+ */
+void AllocationProfiler::report(ostream &out, size_t top) const {
+    vector<size_t> order(site_list.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    top = min(top, order.size());
+    partial_sort(order.begin(), order.begin() + top, order.end(), [&](size_t a, size_t b) {
+        return site_list[a].alloc_bytes > site_list[b].alloc_bytes;
+    });
+
+    out << "Allocation sites (1 sample per ~" << sample_rate << " bytes):\n";
+    for (size_t i = 0; i < top; i++) {
+        const profile_site &site = site_list[order[i]];
+        size_t seen = site.survived + site.freed_young; // Samples that met a collection
+        out << "  " << site.alloc_objects << " samples, " << site.alloc_bytes << " bytes, "
+            << site.live_bytes << " live, survival "
+            << (seen ? 100.0 * site.survived / seen : 0.0) << "%\n";
+        char **symbols = backtrace_symbols(site.frames.data(), site.frames.size());
+        for (size_t f = 0; f < site.frames.size(); f++) {
+            out << "      " << (symbols ? symbols[f] : "?") << "\n";
+        }
+        free(symbols);
+    }
+}
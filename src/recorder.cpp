@@ -0,0 +1,295 @@
+#include <string.h>
+#include <sys/resource.h>
+#include <recorder.h>
+#include <gc.h>
+#include <heap.h>
+#include <gc_stats.h>
+
+/**
+ * Creates the trace file with a large stdio buffer, so recording costs a
+ * few bytes of memcpy per operation rather than a write() call.
+ *
+ * @param path File to create.
+ * @return True on success.
+ */
+bool AllocationRecorder::open(const char *path) {
+    close();
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, RECORD_BUFFER);
+    next_id = 0;
+    ops = 0;
+    ids.clear();
+    return fwrite(RECORD_MAGIC, 1, 8, file) == 8;
+}
+
+/**
+ * Closes the trace file if one is open.
+ *
+ * @return True unless writing failed.
+ */
+bool AllocationRecorder::close() {
+    if (file == NULL) {
+        return true;
+    }
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    file = NULL;
+    ids.clear();
+    return ok;
+}
+
+/**
+ * Writes an unsigned LEB128 varint: seven bits per byte, low bits first,
+ * with the top bit set on every byte but the last.
+ *
+ * @param value The value to write.
+ */
+void AllocationRecorder::put_varint(uint64_t value) {
+    while (value >= 0x80) {
+        putc((int)(value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int)value, file);
+}
+
+/**
+ * Records an allocation and, if it succeeded, names the object.
+ *
+ * @param ptr The new object or NULL.
+ * @param size Bytes requested.
+ * @param op Which allocation function was called.
+ * @param align Alignment operand of OP_ALLOC_ALIGNED.
+ */
+void AllocationRecorder::alloc(void *ptr, size_t size, record_op_t op, size_t align) {
+    if (file == NULL) return;
+    putc(op, file);
+    put_varint(size);
+    if (op == OP_ALLOC_ALIGNED) put_varint(align);
+    if (ptr) {
+        ids[ptr] = next_id;
+    }
+    next_id++;
+    ops++;
+}
+
+/**
+ * Records a root change or explicit free of a known object.
+ *
+ * @param op The operation.
+ * @param ptr The object.
+ */
+void AllocationRecorder::object_op(record_op_t op, void *ptr) {
+    if (file == NULL) return;
+    auto id = ids.find(ptr);
+    if (id == ids.end()) return;
+    putc(op, file);
+    put_varint(id->second);
+    if (op == OP_FREE) {
+        ids.erase(id);
+    }
+    ops++;
+}
+
+/**
+ * Records a nested reference between two known objects. Field 0, the only
+ * one the simulator can write, keeps the shorter OP_NESTED encoding.
+ *
+ * @param src Source object.
+ * @param dest Target object.
+ * @param field Field of the source written.
+ */
+void AllocationRecorder::nested(void *src, void *dest, size_t field) {
+    if (file == NULL) return;
+    auto src_id = ids.find(src);
+    auto dest_id = ids.find(dest);
+    if (src_id == ids.end() || dest_id == ids.end()) return;
+    putc(field ? OP_NESTED_FIELD : OP_NESTED, file);
+    put_varint(src_id->second);
+    put_varint(dest_id->second);
+    if (field) put_varint(field);
+    ops++;
+}
+
+/**
+ * Records a collection and drops the freed objects' names.
+ *
+ * @param op OP_RC, OP_MS or OP_MS_PACED.
+ * @param deleted Objects freed by the collection.
+ */
+void AllocationRecorder::collect(record_op_t op, const list<void*> &deleted) {
+    if (file == NULL) return;
+    putc(op, file);
+    for (void *ptr : deleted) {
+        ids.erase(ptr);
+    }
+    ops++;
+}
+
+/**
+ * Reads an unsigned LEB128 varint.
+ *
+ * @param file Trace being read.
+ * @param value Output: the value.
+ * @return False at end of file or on an over-long encoding.
+ */
+static bool get_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = getc(file);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/**
+ * Replays a trace. Objects are kept by id in a vector, and the pointers a
+ * collection frees are mapped back to ids so that later operations on
+ * them are skipped rather than applied to a reused address. That happens in
+ * the collection hook, so collections the replaying pacer runs inside an
+ * allocation are accounted for like the recorded ones.
+ *
+ * @param path Trace file.
+ * @param gc Collector to drive.
+ * @param heap Heap to allocate from.
+ * @param result Output: measurements.
+ * @return True if the whole trace was replayed.
+ */
+bool replay_trace(const char *path, GarbageCollector &gc, Heap &heap, replay_result &result) {
+    memset(&result, 0, sizeof(result));
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, RECORD_BUFFER);
+
+    char magic[8];
+    if (fread(magic, 1, 8, file) != 8 || memcmp(magic, RECORD_MAGIC, 8) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    vector<void*> objects;
+    unordered_map<void*, uint64_t> ids;
+    result.min_available = heap.available_memory();
+    uint64_t start = gc_now_ns();
+    uint64_t gc_ns = 0;
+    bool ok = true;
+    bool paced = gc.next_collection() != SIZE_MAX;
+
+    gc.set_collection_hook([&](const list<void*> &deleted) {
+        for (void *ptr : deleted) {
+            auto id = ids.find(ptr);
+            if (id != ids.end()) {
+                objects[id->second] = NULL;
+                ids.erase(id);
+            }
+        }
+        result.collections++;
+        gc_ns += gc.last_stats().pause_ns;
+        double fragmentation = heap.fragmentation();
+        if (fragmentation > result.max_fragmentation) {
+            result.max_fragmentation = fragmentation;
+        }
+    });
+
+    // Resolves an operand to a live object, or NULL
+    auto object = [&](uint64_t *id) -> void * {
+        if (!get_varint(file, id) || *id >= objects.size()) {
+            ok = false;
+            return NULL;
+        }
+        return objects[*id];
+    };
+
+    int op;
+    while (ok && (op = getc(file)) != EOF) {
+        uint64_t a, b;
+        switch (op) {
+            case OP_ALLOC:
+            case OP_ALLOC_ATOMIC:
+            case OP_ALLOC_ALIGNED: {
+                if (!get_varint(file, &a)) { ok = false; break; }
+                if (op == OP_ALLOC_ALIGNED && !get_varint(file, &b)) { ok = false; break; }
+                void *ptr = op == OP_ALLOC ? gc.malloc(a, &heap)
+                          : op == OP_ALLOC_ATOMIC ? gc.malloc_atomic(a, &heap)
+                          : gc.aligned_malloc(a, b, &heap);
+                if (ptr) {
+                    ids[ptr] = objects.size();
+                } else {
+                    result.failed_allocations++;
+                }
+                objects.push_back(ptr);
+                result.allocations++;
+                break;
+            }
+            case OP_REF: {
+                void *ptr = object(&a);
+                if (ptr) gc.add_reference(ptr);
+                break;
+            }
+            case OP_NESTED:
+            case OP_NESTED_FIELD: {
+                uint64_t field = 0;
+                void *src = object(&a);
+                void *dest = ok ? object(&b) : NULL;
+                if (op == OP_NESTED_FIELD && !get_varint(file, &field)) { ok = false; break; }
+                if (src && dest) gc.add_nested_reference(src, dest, field);
+                break;
+            }
+            case OP_DELREF: {
+                void *ptr = object(&a);
+                if (ptr) gc.delete_reference(ptr);
+                break;
+            }
+            case OP_FREE: {
+                void *ptr = object(&a);
+                if (ptr) {
+                    gc.free(ptr, &heap);
+                    ids.erase(ptr);
+                    objects[a] = NULL;
+                }
+                break;
+            }
+            case OP_RC:
+                gc.rc_collect(&heap);
+                break;
+            case OP_MS:
+                gc.ms_collect(&heap);
+                break;
+            case OP_MS_PACED:
+                // A replaying pacer decides for itself when to collect
+                if (paced) {
+                    result.skipped_collections++;
+                } else {
+                    gc.ms_collect(&heap);
+                }
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) break;
+
+        result.operations++;
+        size_t available = heap.available_memory();
+        if (available < result.min_available) {
+            result.min_available = available;
+        }
+    }
+    fclose(file);
+    gc.set_collection_hook(nullptr);
+
+    result.seconds = (gc_now_ns() - start) / 1e9;
+    result.gc_seconds = gc_ns / 1e9;
+    result.end_fragmentation = heap.fragmentation();
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        result.peak_rss_kb = usage.ru_maxrss;
+    }
+    return ok;
+}
@@ -0,0 +1,54 @@
+#include <region.h>
+#include <gc.h>
+#include <heap.h>
+
+/**
+ * Carves the region out of the heap's free list, even above the large
+ * object threshold, and registers it as a root source.
+ *
+ * @param gc Collector to register with.
+ * @param heap Heap to allocate the region from.
+ * @param capacity Size of the region in bytes.
+ */
+Region::Region(GarbageCollector &gc, Heap *heap, size_t capacity) : gc(gc), heap(heap) {
+    base = (char *)heap->free_list_malloc(capacity);
+    limit = base ? base + capacity : NULL;
+    cursor = base ? begin() : NULL;
+    if (base) {
+        gc.add_region(this);
+    }
+}
+
+/**
+ * Releases the region if it is still live.
+ */
+Region::~Region() {
+    release();
+}
+
+/**
+ * Bump-allocates from the region.
+ *
+ * @param size Number of bytes requested.
+ * @return Pointer to the memory, or NULL if it does not fit.
+ */
+void *Region::allocate(size_t size) {
+    if (!base) return NULL;
+
+    uintptr_t start = ((uintptr_t)cursor + REGION_ALIGN - 1) & ~(uintptr_t)(REGION_ALIGN - 1);
+    if (start > (uintptr_t)limit || size > (uintptr_t)limit - start) {
+        return NULL;
+    }
+    cursor = (char *)start + size;
+    return (void *)start;
+}
+
+/**
+ * Returns the region's block to the heap in one free.
+ */
+void Region::release() {
+    if (!base) return;
+    gc.remove_region(this);
+    heap->my_free(base);
+    base = cursor = limit = NULL;
+}
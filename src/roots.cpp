@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <roots.h>
+#include <gc.h>
+
+/**
+ * Frees the slot chunks and their links.
+ */
+RootTable::~RootTable() {
+    for (void **chunk : chunks) {
+        delete[] chunk;
+    }
+    for (slot_link *chunk : links) {
+        delete[] chunk;
+    }
+}
+
+/**
+ * Stores a pointer in the table, preferring a released slot that belongs to
+ * the innermost scope and otherwise bumping the top. A new chunk is only
+ * allocated when the top crosses a chunk boundary. The slot becomes the head
+ * of the pointer's chain.
+ *
+ * @param ptr Pointer to store.
+ * @return Index of the slot holding `ptr`.
+ */
+size_t RootTable::push(void *ptr) {
+    size_t slot;
+    if (!free_slots.empty() && free_slots.back() >= scope_base) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        if (top == chunks.size() * ROOT_CHUNK_SLOTS) {
+            chunks.push_back(new void *[ROOT_CHUNK_SLOTS]);
+            links.push_back(new slot_link[ROOT_CHUNK_SLOTS]);
+        }
+        slot = top++;
+    }
+    chunks[slot / ROOT_CHUNK_SLOTS][slot % ROOT_CHUNK_SLOTS] = ptr;
+    if (ptr) {
+        auto head = newest.try_emplace(ptr, slot);
+        link(slot) = { NO_SLOT, NO_SLOT };
+        if (!head.second) {
+            link(slot).older = head.first->second;
+            link(head.first->second).newer = slot;
+            head.first->second = slot;
+        }
+    }
+    return slot;
+}
+
+/**
+ * Clears a slot. The topmost slot is popped; any other slot goes on the
+ * free list.
+ *
+ * @param slot Index of the slot to clear.
+ */
+void RootTable::release(size_t slot) {
+    assert(slot < top && get(slot) != NULL);
+    void *&entry = chunks[slot / ROOT_CHUNK_SLOTS][slot % ROOT_CHUNK_SLOTS];
+    if (entry) {
+        unlink(entry, slot);
+    }
+    entry = NULL;
+    if (slot + 1 == top) {
+        top--;
+    } else {
+        free_slots.push_back(slot);
+    }
+}
+
+/**
+ * Looks up the head of the pointer's chain: the slot pushed last.
+ *
+ * @param ptr Pointer to look for.
+ * @param slot Output: index of the matching slot.
+ * @return True if found.
+ */
+bool RootTable::find(void *ptr, size_t *slot) const {
+    auto head = newest.find(ptr);
+    if (!ptr || head == newest.end()) {
+        return false;
+    }
+    *slot = head->second;
+    return true;
+}
+
+/**
+ * Releases the pointer's slots by following its chain, without touching
+ * the rest of the table.
+ *
+ * @param ptr Pointer whose roots to drop.
+ * @return Number of slots cleared.
+ */
+size_t RootTable::release_all(void *ptr) {
+    size_t released = 0;
+    size_t slot;
+    while (find(ptr, &slot)) {
+        release(slot);
+        released++;
+    }
+    return released;
+}
+
+/**
+ * Joins the slot's neighbours in the chain, moving or dropping the head
+ * when the slot is the newest one.
+ *
+ * @param ptr Pointer held by the slot.
+ * @param slot Index of the slot.
+ */
+void RootTable::unlink(void *ptr, size_t slot) {
+    slot_link &l = link(slot);
+    if (l.older != NO_SLOT) {
+        link(l.older).newer = l.newer;
+    }
+    if (l.newer != NO_SLOT) {
+        link(l.newer).older = l.older;
+    } else if (l.older != NO_SLOT) {
+        newest.find(ptr)->second = l.older;
+    } else {
+        newest.erase(ptr);
+    }
+}
+
+/**
+ * Drops all slots at or above `new_top` and forgets free-list entries in
+ * that range.
+ *
+ * @param new_top The top to return to.
+ */
+void RootTable::truncate(size_t new_top) {
+    if (new_top >= top) return;
+    for (size_t i = new_top; i < top; i++) {
+        void *&entry = chunks[i / ROOT_CHUNK_SLOTS][i % ROOT_CHUNK_SLOTS];
+        if (entry) {
+            unlink(entry, i);
+        }
+        entry = NULL;
+    }
+    top = new_top;
+
+    size_t kept = 0;
+    for (size_t slot : free_slots) {
+        if (slot < new_top) {
+            free_slots[kept++] = slot;
+        }
+    }
+    free_slots.resize(kept);
+}
+
+/**
+ * Opens a scope on the collector's root table.
+ *
+ * @param gc The collector whose roots this scope releases.
+ */
+HandleScope::HandleScope(GarbageCollector &gc) : gc(gc) {
+    saved_top = gc.root_set.size();
+    saved_base = gc.root_set.scope_base;
+    gc.root_set.scope_base = saved_top;
+}
+
+/**
+ * Releases every root pushed since the scope was opened.
+ */
+HandleScope::~HandleScope() {
+    gc.release_references(saved_top);
+    gc.root_set.scope_base = saved_base;
+}
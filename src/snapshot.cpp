@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <snapshot.h>
+#include <gc.h>
+#include <heap.h>
+#include <region.h>
+
+#define SNAPSHOT_BUFFER (64 * 1024) // stdio buffer of a snapshot being written or read
+
+/**
+ * Writes an unsigned LEB128 varint, as the allocation recorder does.
+ *
+ * @param file Snapshot being written.
+ * @param value The value to write.
+ */
+static void put_varint(FILE *file, uint64_t value) {
+    while (value >= 0x80) {
+        putc((int)(value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int)value, file);
+}
+
+/**
+ * Reads an unsigned LEB128 varint.
+ *
+ * @param file Snapshot being read.
+ * @param value Output: the value.
+ * @return False at end of file or on an over-long encoding.
+ */
+static bool get_varint(FILE *file, uint64_t *value) {
+    *value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        int byte = getc(file);
+        if (byte == EOF) return false;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/**
+ * Writes a snapshot of the heap. The live blocks (tracked allocations and
+ * slab objects) are gathered and sorted once; after that every block is
+ * written with its outgoing edges as it is scanned, so the only extra
+ * memory is one address per block. Edges are found the way the mark phase
+ * finds them: every word of a block that holds the address of a block.
+ *
+ * @param path File to create.
+ * @param heap Heap whose slab objects are included.
+ * @return True if the whole snapshot was written.
+ */
+bool GarbageCollector::dump_snapshot(const char *path, Heap *heap) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_BUFFER);
+    fwrite(SNAPSHOT_MAGIC, 1, 8, file);
+
+    vector<void*> blocks;
+    blocks.reserve(allocations.size());
+    for (auto &block : allocations) {
+        blocks.push_back(block.first);
+    }
+    size_t tracked = blocks.size();
+    heap->slab_objects(blocks);
+    inplace_merge(blocks.begin(), blocks.begin() + tracked, blocks.end());
+
+    // Number of the block starting at `ptr`, or SNAPSHOT_UNREACHABLE
+    auto find = [&](void *ptr) -> size_t {
+        auto block = lower_bound(blocks.begin(), blocks.end(), ptr);
+        return block != blocks.end() && *block == ptr ? block - blocks.begin() : SNAPSHOT_UNREACHABLE;
+    };
+
+    vector<size_t> targets;
+    uintptr_t previous = 0;
+    for (void *block : blocks) {
+        allocation *alloc = (allocation *)((char *)block - sizeof(allocation));
+        uint8_t flags = (alloc->marked ? SNAP_FLAG_MARKED : 0) |
+                        (alloc->pointer_free ? SNAP_FLAG_POINTER_FREE : 0) |
+                        (alloc->large ? SNAP_FLAG_LARGE : 0) |
+                        (alloc->slab ? SNAP_FLAG_SLAB : 0) |
+                        (alloc->age << SNAP_FLAG_AGE_SHIFT);
+
+        targets.clear();
+        if (!alloc->pointer_free) {
+            uintptr_t *scan = (uintptr_t *)block;
+            uintptr_t *end = (uintptr_t *)((char *)block + alloc->size);
+            for (; scan < end; ++scan) {
+                size_t target = find((void *)*scan);
+                if (target != SNAPSHOT_UNREACHABLE) targets.push_back(target);
+            }
+        }
+
+        putc(SNAP_BLOCK, file);
+        put_varint(file, (uintptr_t)block - previous);
+        put_varint(file, alloc->size);
+        putc(flags, file);
+        put_varint(file, targets.size());
+        for (size_t target : targets) {
+            put_varint(file, target);
+        }
+        previous = (uintptr_t)block;
+    }
+
+    size_t roots = 0;
+    for (size_t slot = 0; slot < root_set.size(); slot++) {
+        size_t block = find(root_set.get(slot));
+        if (block == SNAPSHOT_UNREACHABLE) continue;
+        putc(SNAP_ROOT, file);
+        put_varint(file, ROOT_SLOT);
+        put_varint(file, block);
+        roots++;
+    }
+
+    // Region words are conservative roots, interior pointers included
+    for (Region *region : regions) {
+        uintptr_t *scan = (uintptr_t *)region->begin();
+        uintptr_t *end = (uintptr_t *)region->end();
+        for (; scan < end; ++scan) {
+            auto block = upper_bound(blocks.begin(), blocks.end(), (void *)*scan);
+            if (block == blocks.begin()) continue;
+            --block;
+            allocation *alloc = (allocation *)((char *)*block - sizeof(allocation));
+            if (*scan >= (uintptr_t)*block + alloc->size) continue;
+            putc(SNAP_ROOT, file);
+            put_varint(file, ROOT_REGION);
+            put_varint(file, block - blocks.begin());
+            roots++;
+        }
+    }
+
+    putc(SNAP_END, file);
+    put_varint(file, blocks.size());
+    put_varint(file, roots);
+
+    bool ok = !ferror(file);
+    return fclose(file) == 0 && ok;
+}
+
+/**
+ * Reads a snapshot record by record. Block numbers are checked once the
+ * end record has confirmed how many blocks there are.
+ *
+ * @param path Snapshot file.
+ * @param snapshot Output: the snapshot.
+ * @return True if the snapshot is complete and consistent.
+ */
+bool read_snapshot(const char *path, heap_snapshot &snapshot) {
+    snapshot.blocks.clear();
+    snapshot.edges.clear();
+    snapshot.roots.clear();
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_BUFFER);
+
+    char magic[8];
+    bool ok = fread(magic, 1, 8, file) == 8 && memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    bool ended = false;
+    uintptr_t address = 0;
+    while (ok && !ended) {
+        int tag = getc(file);
+        uint64_t a, b, count;
+        switch (tag) {
+            case SNAP_BLOCK: {
+                int flags;
+                ok = get_varint(file, &a) && get_varint(file, &b) &&
+                     (flags = getc(file)) != EOF && get_varint(file, &count);
+                if (!ok) break;
+                address += a;
+                snapshot.blocks.push_back({ address, (size_t)b, (uint8_t)flags, snapshot.edges.size() });
+                for (uint64_t i = 0; ok && i < count; i++) {
+                    ok = get_varint(file, &a);
+                    snapshot.edges.push_back(a);
+                }
+                break;
+            }
+            case SNAP_ROOT:
+                ok = get_varint(file, &a) && get_varint(file, &b) && a <= ROOT_REGION;
+                if (ok) snapshot.roots.push_back({ (snapshot_root_t)a, (size_t)b });
+                break;
+            case SNAP_END:
+                ok = get_varint(file, &a) && get_varint(file, &b) &&
+                     a == snapshot.blocks.size() && b == snapshot.roots.size();
+                ended = true;
+                break;
+            default:
+                ok = false;
+                break;
+        }
+    }
+    fclose(file);
+
+    size_t n = snapshot.blocks.size();
+    for (size_t i = 0; ok && i < snapshot.edges.size(); i++) {
+        ok = snapshot.edges[i] < n;
+    }
+    for (size_t i = 0; ok && i < snapshot.roots.size(); i++) {
+        ok = snapshot.roots[i].block < n;
+    }
+    return ok && ended;
+}
+
+/**
+ * Lengauer-Tarjan with path compression ("simple" linking, O(E log V)).
+ * Node `n` is a virtual root with an edge to every root; the DFS and the
+ * path compression are iterative, since a long list would overflow the
+ * C stack. Semidominators are kept as DFS numbers.
+ *
+ * @param snapshot The snapshot.
+ * @param analysis Output: dominators, retained sizes and histograms.
+ */
+void analyze_snapshot(const heap_snapshot &snapshot, snapshot_analysis &analysis) {
+    const size_t n = snapshot.blocks.size();
+    const size_t none = SNAPSHOT_UNREACHABLE;
+
+    analysis.idom.assign(n + 1, none);
+    analysis.retained.assign(n + 1, 0);
+    analysis.reachable_blocks = 0;
+    analysis.reachable_bytes = 0;
+    analysis.unreachable_blocks = 0;
+    analysis.unreachable_bytes = 0;
+    memset(analysis.size_blocks, 0, sizeof(analysis.size_blocks));
+    memset(analysis.size_bytes, 0, sizeof(analysis.size_bytes));
+
+    // Successors of the virtual root, then predecessors of every node
+    vector<size_t> root_edges;
+    for (const snapshot_root &root : snapshot.roots) {
+        root_edges.push_back(root.block);
+    }
+    auto successors = [&](size_t v, const size_t **begin, const size_t **end) {
+        if (v == n) {
+            *begin = root_edges.data();
+            *end = root_edges.data() + root_edges.size();
+        } else {
+            *begin = snapshot.edges.data() + snapshot.blocks[v].first_edge;
+            *end = snapshot.edges.data() + snapshot.edges_end(v);
+        }
+    };
+
+    vector<size_t> pred_start(n + 2, 0);
+    vector<size_t> preds(snapshot.edges.size() + root_edges.size());
+    for (size_t v = 0; v <= n; v++) {
+        const size_t *begin, *end;
+        successors(v, &begin, &end);
+        for (; begin < end; ++begin) pred_start[*begin + 1]++;
+    }
+    for (size_t v = 0; v <= n; v++) pred_start[v + 1] += pred_start[v];
+    vector<size_t> fill(pred_start.begin(), pred_start.end() - 1);
+    for (size_t v = 0; v <= n; v++) {
+        const size_t *begin, *end;
+        successors(v, &begin, &end);
+        for (; begin < end; ++begin) preds[fill[*begin]++] = v;
+    }
+
+    // Depth-first numbering from the virtual root
+    vector<size_t> dfn(n + 1, none), vertex, parent(n + 1, none);
+    vector<pair<size_t, size_t>> stack = { { n, none } };
+    while (!stack.empty()) {
+        auto [v, from] = stack.back();
+        stack.pop_back();
+        if (dfn[v] != none) continue;
+        dfn[v] = vertex.size();
+        vertex.push_back(v);
+        parent[v] = from;
+        const size_t *begin, *end;
+        successors(v, &begin, &end);
+        for (const size_t *w = end; w > begin; ) {
+            --w;
+            if (dfn[*w] == none) stack.push_back({ *w, v });
+        }
+    }
+
+    vector<size_t> semi(dfn), ancestor(n + 1, none), label(n + 1);
+    vector<vector<size_t>> bucket(n + 1);
+    vector<size_t> path;
+    for (size_t v = 0; v <= n; v++) label[v] = v;
+
+    // Node with the least semidominator on v's path in the linked forest
+    auto eval = [&](size_t v) -> size_t {
+        if (ancestor[v] == none) return v;
+        for (size_t x = v; ancestor[ancestor[x]] != none; x = ancestor[x]) {
+            path.push_back(x);
+        }
+        while (!path.empty()) {
+            size_t y = path.back();
+            path.pop_back();
+            size_t a = ancestor[y];
+            if (semi[label[a]] < semi[label[y]]) label[y] = label[a];
+            ancestor[y] = ancestor[a];
+        }
+        return label[v];
+    };
+
+    for (size_t i = vertex.size() - 1; i > 0; i--) {
+        size_t w = vertex[i];
+        for (size_t p = pred_start[w]; p < pred_start[w + 1]; p++) {
+            size_t v = preds[p];
+            if (dfn[v] == none) continue; // Unreachable predecessor
+            size_t u = eval(v);
+            if (semi[u] < semi[w]) semi[w] = semi[u];
+        }
+        bucket[vertex[semi[w]]].push_back(w);
+        ancestor[w] = parent[w];
+        for (size_t v : bucket[parent[w]]) {
+            size_t u = eval(v);
+            analysis.idom[v] = semi[u] < semi[v] ? u : parent[w];
+        }
+        bucket[parent[w]].clear();
+    }
+    for (size_t i = 1; i < vertex.size(); i++) {
+        size_t w = vertex[i];
+        if (analysis.idom[w] != vertex[semi[w]]) {
+            analysis.idom[w] = analysis.idom[analysis.idom[w]];
+        }
+    }
+
+    // A node's dominator subtree follows it in DFS order, so one reverse pass sums it
+    for (size_t i = vertex.size() - 1; i > 0; i--) {
+        size_t w = vertex[i];
+        analysis.retained[w] += snapshot.blocks[w].size;
+        analysis.retained[analysis.idom[w]] += analysis.retained[w];
+    }
+
+    for (size_t v = 0; v < n; v++) {
+        size_t size = snapshot.blocks[v].size;
+        unsigned size_class = size ? 64 - __builtin_clzll(size) : 0;
+        if (size_class >= GC_HISTOGRAM_BUCKETS) size_class = GC_HISTOGRAM_BUCKETS - 1;
+        analysis.size_blocks[size_class]++;
+        analysis.size_bytes[size_class] += size;
+        if (dfn[v] != none) {
+            analysis.reachable_blocks++;
+            analysis.reachable_bytes += size;
+        } else {
+            analysis.unreachable_blocks++;
+            analysis.unreachable_bytes += size;
+        }
+    }
+    analysis.idom.resize(n);
+    analysis.retained.resize(n);
+}
+
+/**
+ * Picks the blocks retaining the most bytes with a partial sort.
+ *
+ * @param analysis An analysis.
+ * @param count How many blocks to return.
+ * @return Block indexes, largest retained size first.
+ */
+vector<size_t> top_retainers(const snapshot_analysis &analysis, size_t count) {
+    vector<size_t> blocks(analysis.retained.size());
+    for (size_t i = 0; i < blocks.size(); i++) blocks[i] = i;
+    count = min(count, blocks.size());
+    partial_sort(blocks.begin(), blocks.begin() + count, blocks.end(), [&](size_t a, size_t b) {
+        return analysis.retained[a] > analysis.retained[b];
+    });
+    blocks.resize(count);
+    return blocks;
+}
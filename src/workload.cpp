@@ -0,0 +1,308 @@
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <random>
+#include <workload.h>
+#include <gc.h>
+#include <heap.h>
+
+static const char *shape_names[] = { "list", "tree", "dag", "cycles", "power-law" };
+
+/**
+ * Allocates an object, keeps the root slot malloc() pushed for it and
+ * clears it, so stale words from a previous workload do not pin anything.
+ *
+ * @param id Object id, one more than the last.
+ * @param size Bytes to allocate.
+ * @return False if the heap is full.
+ */
+bool GcWorkloadSink::alloc(size_t id, size_t size) {
+    size_t slot = (size_t)-1;
+    void *ptr = gc.malloc(size, heap, &slot);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    objects.resize(id + 1);
+    slots.resize(id + 1, (size_t)-1);
+    objects[id] = ptr;
+    slots[id] = slot;
+    return ptr != NULL;
+}
+
+/**
+ * Writes `dest` into a field of `src`.
+ *
+ * @param src Source object id.
+ * @param dest Target object id.
+ * @param field Pointer-sized field of the source.
+ */
+void GcWorkloadSink::link(size_t src, size_t dest, size_t field) {
+    gc.add_nested_reference(objects[src], objects[dest], field);
+}
+
+/**
+ * Releases the root slot an object was allocated with, if it still has it.
+ *
+ * @param id Object id.
+ */
+void GcWorkloadSink::unroot(size_t id) {
+    if (slots[id] != (size_t)-1) {
+        gc.release_reference(slots[id]);
+        slots[id] = (size_t)-1;
+    }
+}
+
+/**
+ * Releases every root the workload still holds.
+ */
+void GcWorkloadSink::release_roots() {
+    for (size_t id = 0; id < slots.size(); id++) {
+        unroot(id);
+    }
+}
+
+/**
+ * Writes an `alloc` command naming the object after its id.
+ *
+ * @param id Object id.
+ * @param size Bytes to allocate.
+ * @return Always true; the script decides later whether it fits.
+ */
+bool ScriptWorkloadSink::alloc(size_t id, size_t size) {
+    out << "alloc o" << id << " " << size << "\n";
+    return true;
+}
+
+/**
+ * Writes a nested `ref` command.
+ *
+ * @param src Source object id.
+ * @param dest Target object id.
+ * @param field Pointer-sized field of the source.
+ */
+void ScriptWorkloadSink::link(size_t src, size_t dest, size_t field) {
+    out << "ref o" << src << " o" << dest << " " << field << "\n";
+}
+
+/**
+ * Writes a `delref` command.
+ *
+ * @param id Object id.
+ */
+void ScriptWorkloadSink::unroot(size_t id) {
+    out << "delref o" << id << "\n";
+}
+
+/**
+ * Number of pointer fields each object of a shape needs.
+ *
+ * @param params Workload parameters.
+ * @return At least one.
+ */
+static size_t shape_fields(const workload_params &params) {
+    switch (params.shape) {
+        case SHAPE_LIST: return 1;
+        case SHAPE_TREE: return 2;
+        default: return max(params.max_fanout, (size_t)1);
+    }
+}
+
+/**
+ * Builds the edges of one component of `n` objects, numbered from 0. Field 0
+ * always holds the chain, ring or tree edge that makes every object
+ * reachable from object 0; the other fields hold the shape's extra edges.
+ *
+ * @param params Workload parameters.
+ * @param n Objects in the component.
+ * @param fields Pointer fields per object.
+ * @param rng Random source.
+ * @param degree Power-law out-degree distribution over [1, fields].
+ * @param edges Output: (source, target, field) triples.
+ */
+static void component_edges(const workload_params &params, size_t n, size_t fields, mt19937 &rng,
+                            discrete_distribution<size_t> &degree, vector<size_t> &edges) {
+    auto edge = [&](size_t src, size_t dest, size_t field) {
+        edges.push_back(src);
+        edges.push_back(dest);
+        edges.push_back(field);
+    };
+
+    // Targets of preferential attachment: each object once, plus once per edge into it
+    vector<size_t> targets;
+
+    for (size_t i = 0; i < n; i++) {
+        switch (params.shape) {
+            case SHAPE_LIST:
+                if (i + 1 < n) edge(i, i + 1, 0);
+                break;
+            case SHAPE_TREE:
+                if (i > 0) edge((i - 1) / 2, i, (i - 1) % 2);
+                break;
+            case SHAPE_DAG: {
+                if (i + 1 < n) edge(i, i + 1, 0);
+                size_t extra = rng() % fields;
+                for (size_t field = 1; field <= extra && i + 2 < n; field++) {
+                    edge(i, i + 2 + rng() % (n - i - 2), field);
+                }
+                break;
+            }
+            case SHAPE_CYCLES: {
+                edge(i, (i + 1) % n, 0);
+                size_t extra = rng() % fields;
+                for (size_t field = 1; field <= extra; field++) {
+                    edge(i, rng() % n, field);
+                }
+                break;
+            }
+            case SHAPE_POWER_LAW:
+                targets.push_back(i);
+                break;
+        }
+    }
+
+    if (params.shape == SHAPE_POWER_LAW) {
+        for (size_t i = 0; i < n; i++) {
+            if (i + 1 < n) edge(i, i + 1, 0);
+            size_t extra = degree(rng);
+            for (size_t field = 1; field <= extra; field++) {
+                size_t dest = targets[rng() % targets.size()];
+                edge(i, dest, field);
+                targets.push_back(dest);
+            }
+        }
+    }
+}
+
+/**
+ * Counts the objects of a component reachable from object 0.
+ *
+ * @param n Objects in the component.
+ * @param edges Edges whose endpoints were both allocated.
+ * @param allocated Which objects were allocated.
+ * @return Reachable objects, 0 if object 0 was not allocated.
+ */
+static size_t reachable(size_t n, const vector<size_t> &edges, const vector<bool> &allocated) {
+    if (n == 0 || !allocated[0]) return 0;
+    vector<vector<size_t>> out(n);
+    for (size_t e = 0; e < edges.size(); e += 3) {
+        out[edges[e]].push_back(edges[e + 1]);
+    }
+    vector<bool> seen(n, false);
+    vector<size_t> stack = { 0 };
+    seen[0] = true;
+    size_t count = 0;
+    while (!stack.empty()) {
+        size_t i = stack.back();
+        stack.pop_back();
+        count++;
+        for (size_t dest : out[i]) {
+            if (!seen[dest]) {
+                seen[dest] = true;
+                stack.push_back(dest);
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Generates a workload one component at a time, so the generator itself
+ * holds only one component's edges.
+ *
+ * @param params The shape and size of the graph.
+ * @param sink Where the operations go.
+ * @return Counts of what was built.
+ */
+workload_result generate_workload(const workload_params &params, WorkloadSink &sink) {
+    workload_result result = {};
+    mt19937 rng(params.seed);
+    size_t fields = shape_fields(params);
+    size_t size = max(params.object_size, fields * sizeof(void *));
+    size_t component = params.component ? params.component : params.objects;
+
+    // P(out-degree = k) is proportional to k^-alpha; the chain edge is one of the k
+    vector<double> weights;
+    for (size_t k = 1; k <= fields; k++) {
+        weights.push_back(pow((double)k, -params.power_law_alpha));
+    }
+    discrete_distribution<size_t> degree(weights.begin(), weights.end());
+
+    vector<size_t> heads;     // First object of each component
+    vector<size_t> live;      // Objects reachable from each head
+    vector<size_t> edges;
+    vector<bool> allocated;
+    for (size_t base = 0; base < params.objects; base += component) {
+        size_t n = min(component, params.objects - base);
+        allocated.assign(n, false);
+        for (size_t i = 0; i < n; i++) {
+            allocated[i] = sink.alloc(base + i, size);
+            if (!allocated[i]) result.failed++;
+        }
+        result.objects += n;
+
+        edges.clear();
+        component_edges(params, n, fields, rng, degree, edges);
+        size_t kept = 0;
+        for (size_t e = 0; e < edges.size(); e += 3) {
+            if (allocated[edges[e]] && allocated[edges[e + 1]]) {
+                sink.link(base + edges[e], base + edges[e + 1], edges[e + 2]);
+                edges[kept++] = edges[e];
+                edges[kept++] = edges[e + 1];
+                edges[kept++] = edges[e + 2];
+            }
+        }
+        edges.resize(kept);
+        result.edges += kept / 3;
+
+        // Only linked objects are unrooted, so none is unreachable in between
+        for (size_t i = 1; i < n; i++) {
+            if (allocated[i]) sink.unroot(base + i);
+        }
+        if (allocated[0]) {
+            heads.push_back(base);
+            live.push_back(reachable(n, edges, allocated));
+        }
+        result.components++;
+    }
+
+    // Drop the roots of a random (1 - survival) share of the components
+    vector<size_t> order(heads.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+    double survival = min(max(params.survival, 0.0), 1.0);
+    size_t keep = (size_t)llround(survival * heads.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        if (i < keep) {
+            result.roots++;
+            result.survivors += live[order[i]];
+        } else {
+            sink.unroot(heads[order[i]]);
+        }
+    }
+    return result;
+}
+
+/**
+ * Looks a shape up by the name workload_shape_name() gives it.
+ *
+ * @param name Shape name, e.g. "tree".
+ * @param shape Output: the shape.
+ * @return False if the name is unknown.
+ */
+bool parse_workload_shape(const char *name, workload_shape_t *shape) {
+    for (size_t i = 0; i < sizeof(shape_names) / sizeof(shape_names[0]); i++) {
+        if (strcmp(name, shape_names[i]) == 0) {
+            *shape = (workload_shape_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @param shape A shape.
+ * @return Its name, as accepted by parse_workload_shape().
+ */
+const char *workload_shape_name(workload_shape_t shape) {
+    return shape_names[shape];
+}
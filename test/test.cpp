@@ -1,14 +1,27 @@
 #include <gtest/gtest.h>
 #include <gc.h>
 #include <heap.h>
+#include <gc_ptr.h>
+#include <region.h>
+#include <gc_trace.h>
+#include <recorder.h>
+#include <workload.h>
+#include <snapshot.h>
+#include <profiler.h>
 #include <chrono>
+#include <thread>
+#include <unistd.h>
+#include <string.h>
+#include <sstream>
+#include <fstream>
 
 using namespace std;
 using namespace std::chrono;
 
-// Compute the initial free space after subtracting metadata for the first free block
+// Compute the initial free space after subtracting metadata for the first free block.
+// The first block starts just below HEAP_ALIGN so that its payload is aligned.
 static size_t initial_free_space() {
-    return HEAP_SIZE - sizeof(Heap::node_t);
+    return HEAP_SIZE - (HEAP_ALIGN - sizeof(GarbageCollector::allocation)) - sizeof(Heap::node_t);
 }
 
 // Test fixture to reset heap before each test
@@ -19,6 +32,7 @@ protected:
 
     void SetUp() override {
         heap.reset();  // reset the heap to a clean state
+        gc.set_verify_collections(true); // Every collection checks the heap (debug builds)
     }
 };
 
@@ -39,7 +53,7 @@ TEST_F(GCHeapTest, Available_Memory_After_Two_Allocations) {
 
     // Calculate total expected usage including allocation metadata
     size_t alloc_overhead = sizeof(GarbageCollector::allocation);
-    size_t expected = initial_free_space() - 2 * (100 + alloc_overhead);
+    size_t expected = initial_free_space() - 2 * (Heap::align_size(100) + alloc_overhead);
 
     size_t free_mem = heap.available_memory();
     ASSERT_EQ(free_mem, expected);
@@ -115,7 +129,7 @@ TEST_F(GCHeapTest, Reference_Counting_Leaves_Cycle) {
 
     // The cycle is unreachable but still present due to RC limitation
     size_t alloc_overhead = sizeof(GarbageCollector::allocation);
-    size_t expected = initial_free_space() - 2 * (100 + alloc_overhead);
+    size_t expected = initial_free_space() - 2 * (Heap::align_size(100) + alloc_overhead);
     ASSERT_EQ(heap.available_memory(), expected);
 }
 
@@ -344,6 +358,1049 @@ TEST_F(GCHeapTest, Efficiency_Stress_Test_Cyclic) {
     }
 }
 
+// Conservative mode keeps an unrooted object alive through a stack reference
+TEST_F(GCHeapTest, Conservative_Stack_Root_Survives) {
+    gc.set_conservative_roots(true);
+    gc.register_thread();
+
+    void* volatile on_stack = gc.malloc(100, &heap);
+    ASSERT_NE(on_stack, nullptr);
+
+    // No root was registered, only the local above refers to the object
+    list<void*> freed = gc.ms_collect(&heap);
+    ASSERT_TRUE(freed.empty());
+    size_t alloc_overhead = sizeof(GarbageCollector::allocation);
+    ASSERT_EQ(heap.available_memory(), initial_free_space() - (Heap::align_size(100) + alloc_overhead));
+
+    gc.unregister_thread();
+}
+
+// Roots pushed inside a HandleScope are released when it closes
+TEST_F(GCHeapTest, Handle_Scope_Releases_Roots) {
+    void* outer = gc.malloc(100, &heap);
+    {
+        HandleScope scope(gc);
+        void* inner = gc.malloc(100, &heap);
+        ASSERT_NE(inner, nullptr);
+        ASSERT_EQ(gc.ms_collect(&heap).size(), 0u);
+    }
+
+    // Only the object allocated inside the scope lost its root
+    list<void*> freed = gc.ms_collect(&heap);
+    ASSERT_EQ(freed.size(), 1u);
+    ASSERT_NE(freed.front(), outer);
+}
+
+// Released root slots are handed out again before the table grows
+TEST_F(GCHeapTest, Root_Slot_Reuse) {
+    void* ptr = gc.malloc(100, &heap);
+    size_t first = gc.add_reference(ptr);
+    size_t second = gc.add_reference(ptr);
+    gc.add_reference(ptr);
+
+    gc.release_reference(first);
+    ASSERT_EQ(gc.root(first), nullptr);
+    ASSERT_EQ(gc.add_reference(ptr), first);
+    ASSERT_EQ(gc.root(second), ptr);
+}
+
+// Releasing a slot that is not in use fails instead of handing the slot out twice
+TEST_F(GCHeapTest, Double_Release_Is_Rejected) {
+    void* ptr = gc.malloc(100, &heap);
+    size_t slot = gc.add_reference(ptr);
+    ASSERT_EQ(gc.release_reference(slot), 0);
+    ASSERT_EQ(gc.release_reference(slot), -1);
+    ASSERT_EQ(gc.release_reference(slot + 1000), -1);
+    ASSERT_NE(gc.add_reference(ptr), gc.add_reference(ptr));
+    ASSERT_TRUE(gc.verify(&heap));
+
+    RootTable table;
+    size_t first = table.push(ptr);
+    table.push(ptr);
+    table.release(first);
+    EXPECT_DEBUG_DEATH(table.release(first), "");
+}
+
+// Each pointer's slots stay chained, newest first, through releases, reuse and truncation
+TEST_F(GCHeapTest, Root_Slot_Chains) {
+    RootTable table;
+    void* a = (void*)0x10;
+    void* b = (void*)0x20;
+    size_t slot;
+    size_t a0 = table.push(a);
+    size_t b0 = table.push(b);
+    size_t a1 = table.push(a);
+    size_t a2 = table.push(a);
+    ASSERT_TRUE(table.find(a, &slot));
+    ASSERT_EQ(slot, a2);
+
+    table.release(a2);
+    table.release(a0);
+    ASSERT_TRUE(table.find(a, &slot));
+    ASSERT_EQ(slot, a1);
+    ASSERT_EQ(table.push(a), a0);
+    ASSERT_TRUE(table.find(a, &slot));
+    ASSERT_EQ(slot, a0);
+
+    table.truncate(a1);
+    ASSERT_TRUE(table.find(a, &slot));
+    ASSERT_EQ(slot, a0);
+    ASSERT_EQ(table.release_all(a), 1u);
+    ASSERT_FALSE(table.find(a, &slot));
+    ASSERT_TRUE(table.find(b, &slot));
+    ASSERT_EQ(slot, b0);
+
+    // free() drops every root of the object, wherever its slots are
+    void* ptr = gc.malloc(100, &heap);
+    size_t first = gc.add_reference(ptr);
+    gc.malloc(16, &heap);
+    size_t last = gc.add_reference(ptr);
+    gc.free(ptr, &heap);
+    ASSERT_EQ(gc.root(first), nullptr);
+    ASSERT_EQ(gc.root(last), nullptr);
+    ASSERT_TRUE(gc.verify(&heap));
+}
+
+// gc_ptr roots its object until the last copy goes away; moves keep the slot
+TEST_F(GCHeapTest, GC_Ptr_Roots_Object) {
+    struct pair_t { void* left; void* right; };
+    {
+        gc_ptr<pair_t> a = gc_new<pair_t>(gc, &heap);
+        ASSERT_TRUE(a);
+        ASSERT_EQ(a->left, nullptr);
+        {
+            gc_ptr<pair_t> copy = a;
+            gc_ptr<pair_t> moved = std::move(a);
+            ASSERT_FALSE(a);
+            ASSERT_EQ(copy.get(), moved.get());
+            a = std::move(moved);
+        }
+        ASSERT_EQ(gc.ms_collect(&heap).size(), 0u);
+        ASSERT_EQ(gc.rc_collect(&heap).size(), 0u);
+    }
+
+    // The last handle released the only root
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 1u);
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+}
+
+// Batch allocation carves objects back to back and roots each of them
+TEST_F(GCHeapTest, Malloc_N_Batch) {
+    const size_t count = 10, blockSize = 32;
+    void* ptrs[count];
+    ASSERT_EQ(gc.malloc_n(count, blockSize, &heap, ptrs), count);
+
+    size_t alloc_overhead = sizeof(GarbageCollector::allocation);
+    for (size_t i = 1; i < count; ++i) {
+        ASSERT_EQ((char*)ptrs[i] - (char*)ptrs[i-1], (ptrdiff_t)(Heap::align_size(blockSize) + alloc_overhead));
+    }
+    ASSERT_EQ(heap.available_memory(),
+              initial_free_space() - count * (Heap::align_size(blockSize) + alloc_overhead));
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 0u);
+
+    for (void* p : ptrs) {
+        gc.delete_reference(p);
+    }
+    ASSERT_EQ(gc.rc_collect(&heap).size(), count);
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+}
+
+// Explicit frees return memory immediately and coalesce in any order
+TEST_F(GCHeapTest, Free_Many_Explicit) {
+    void* ptrs[8];
+    ASSERT_EQ(gc.malloc_n(8, 64, &heap, ptrs), 8u);
+    void* keep = gc.malloc(64, &heap);
+
+    // Free one object on its own, then the rest out of address order
+    gc.free(ptrs[3], &heap);
+    void* batch[] = { ptrs[7], ptrs[0], ptrs[5], ptrs[1], ptrs[6], ptrs[2], ptrs[4] };
+    gc.free_many(batch, 7, &heap);
+
+    size_t block = Heap::align_size(64) + sizeof(GarbageCollector::allocation);
+    ASSERT_EQ(heap.available_memory(), initial_free_space() - block - sizeof(Heap::node_t));
+
+    // The freed run merged into a single block ahead of `keep`
+    ::testing::internal::CaptureStdout();
+    heap.print_free_list();
+    std::string dump = ::testing::internal::GetCapturedStdout();
+    std::ostringstream oss;
+    oss << "Free(" << 8 * block - sizeof(Heap::node_t) << ")->Free("
+        << initial_free_space() - 9 * block << ")->\n";
+    ASSERT_EQ(dump, oss.str());
+
+    // Nothing freed explicitly is reported again by a collection
+    list<void*> freed = gc.ms_collect(&heap);
+    ASSERT_TRUE(freed.empty());
+    gc.delete_reference(keep);
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 1u);
+}
+
+// A batch naming an object twice frees it once, whichever space it lives in
+TEST_F(GCHeapTest, Free_Many_Duplicates) {
+    Heap slabbed(1 << 16);
+    slabbed.add_size_class(32);
+    const size_t initial = slabbed.available_memory();
+    void* slot = gc.malloc(32, &slabbed);
+    void* block = gc.malloc(64, &slabbed);
+    void* large = gc.malloc(2 * LARGE_OBJECT_THRESHOLD, &slabbed);
+    ASSERT_TRUE(slabbed.is_slab_object(slot));
+    ASSERT_TRUE(slabbed.is_large_object(large));
+
+    void* batch[] = { slot, block, large, slot, large, block };
+    gc.free_many(batch, 6, &slabbed);
+    string error;
+    ASSERT_TRUE(slabbed.verify(&error)) << error;
+    ASSERT_TRUE(gc.verify(&slabbed, &error)) << error;
+    ASSERT_EQ(slabbed.large_object_count(), 0u);
+
+    // The heap's own batch free ignores repeats too
+    void* a = slabbed.my_malloc(100);
+    void* b = slabbed.my_malloc(100);
+    void* blocks[] = { b, a, b, a };
+    slabbed.free_many(blocks, 4);
+    ASSERT_TRUE(slabbed.verify(&error)) << error;
+    gc.ms_collect(&slabbed); // Returns the emptied slab page
+    ASSERT_EQ(slabbed.available_memory(), initial);
+}
+
+// A region keeps objects it points to alive and is returned to the heap at once
+TEST_F(GCHeapTest, Region_Roots_And_Release) {
+    void* target = gc.malloc(100, &heap);
+    gc.delete_reference(target);
+    {
+        Region region(gc, &heap, 512);
+        void** temp = (void**)region.allocate(sizeof(void*));
+        ASSERT_NE(temp, nullptr);
+        ASSERT_EQ((uintptr_t)temp % 16, 0u);
+        *temp = target;
+
+        // Reachable only through the region temporary
+        ASSERT_TRUE(gc.ms_collect(&heap).empty());
+        ASSERT_EQ(region.allocate(1024), nullptr);
+    }
+
+    // The region released its block and no longer acts as a root
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 1u);
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+
+    // A region at or above the large object threshold still comes from the free list
+    {
+        Region region(gc, &heap, heap.large_threshold);
+        ASSERT_NE(region.allocate(heap.large_threshold / 2), nullptr);
+        ASSERT_EQ(heap.large_object_count(), 0u);
+        ASSERT_LT(heap.available_memory(), initial_free_space() - heap.large_threshold + 1);
+    }
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+}
+
+// Large requests get their own page-aligned mapping outside the free list
+TEST_F(GCHeapTest, Large_Object_Space) {
+    const size_t large = 3 * HEAP_SIZE;
+    void* big = gc.malloc(large, &heap);
+    ASSERT_NE(big, nullptr);
+    ASSERT_EQ(heap.large_object_count(), 1u);
+    ASSERT_EQ(((uintptr_t)big - HEAP_ALIGN) % sysconf(_SC_PAGESIZE), 0u);
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+
+    // Large objects are scanned like any other block
+    void* small = gc.malloc(100, &heap);
+    gc.add_nested_reference(big, small);
+    gc.delete_reference(small);
+    ASSERT_TRUE(gc.ms_collect(&heap).empty());
+
+    gc.delete_reference(big);
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 2u);
+    ASSERT_EQ(heap.large_object_count(), 0u);
+}
+
+// The scavenger returns free pages beyond the retention threshold and the heap stays usable
+TEST_F(GCHeapTest, Scavenge_Releases_Free_Pages) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    Heap big(64 * page);
+    big.large_threshold = SIZE_MAX;
+
+    std::vector<void*> ptrs(128);
+    ASSERT_EQ(gc.malloc_n(ptrs.size(), page / 4, &big, ptrs.data()), ptrs.size());
+    for (void* p : ptrs) {
+        memset(p, 0xab, page / 4);
+    }
+    ASSERT_EQ(big.scavenge(), 0u);
+
+    // Keep the first few objects and let the collection scavenge the rest
+    for (size_t i = 8; i < ptrs.size(); ++i) {
+        gc.delete_reference(ptrs[i]);
+    }
+    big.scavenge_retain = 4 * page;
+    gc.ms_collect(&big);
+
+    size_t released = big.scavenge();
+    ASSERT_GT(released, 0u);
+    ASSERT_LE(released, big.available_memory() - big.scavenge_retain);
+
+    // Released memory is handed out again
+    size_t size = big.available_memory() / 2;
+    void* again = gc.malloc(size, &big);
+    ASSERT_NE(again, nullptr);
+    memset(again, 0xcd, size);
+    big.reset();
+}
+
+// Huge page heaps are 2MB aligned and whole; MAP_HUGETLB falls back when unavailable
+TEST_F(GCHeapTest, Huge_Page_Heap) {
+    Heap thp(3 * HUGE_PAGE_SIZE, Heap::PAGES_TRANSPARENT_HUGE);
+    thp.start();
+    const size_t offset = HEAP_ALIGN - sizeof(GarbageCollector::allocation);
+    ASSERT_EQ(((uintptr_t)thp.head - offset) % HUGE_PAGE_SIZE, 0u);
+    ASSERT_EQ(thp.heap_size, 3 * HUGE_PAGE_SIZE - sizeof(Heap::node_t));
+    ASSERT_EQ(thp.available_memory(), thp.heap_size - sizeof(Heap::node_t) - offset);
+
+    void* p = gc.malloc(100, &thp);
+    ASSERT_NE(p, nullptr);
+    thp.reset();
+
+    Heap tlb(HUGE_PAGE_SIZE, Heap::PAGES_HUGETLB);
+    ASSERT_NE(tlb.start(), nullptr);
+    ASSERT_EQ(((uintptr_t)tlb.head - offset) % HUGE_PAGE_SIZE, 0u);
+    tlb.reset();
+}
+
+// Every block is 16-byte aligned and aligned_malloc honours larger alignments
+TEST_F(GCHeapTest, Aligned_Allocation) {
+    for (size_t size : {1, 7, 24, 100}) {
+        void* p = gc.malloc(size, &heap);
+        ASSERT_NE(p, nullptr);
+        ASSERT_EQ((uintptr_t)p % HEAP_ALIGN, 0u);
+    }
+
+    void* line = gc.aligned_malloc(40, 64, &heap);
+    void* page = gc.aligned_malloc(8, 512, &heap);
+    ASSERT_EQ((uintptr_t)line % 64, 0u);
+    ASSERT_EQ((uintptr_t)page % 512, 0u);
+
+    // The gaps left before aligned blocks are still usable and coalesce back
+    void* small = gc.malloc(16, &heap);
+    ASSERT_NE(small, nullptr);
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 0u);
+    for (size_t slot = 0; slot < 7; ++slot) {
+        gc.release_reference(slot);
+    }
+    ASSERT_EQ(gc.ms_collect(&heap).size(), 7u);
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+
+    // Large objects honour the alignment too, up to the page size
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    void* big_line = gc.aligned_malloc(heap.large_threshold, 64, &heap);
+    void* big_page = gc.aligned_malloc(heap.large_threshold, page_size, &heap);
+    ASSERT_EQ(heap.large_object_count(), 2u);
+    ASSERT_EQ((uintptr_t)big_line % 64, 0u);
+    ASSERT_EQ((uintptr_t)big_page % page_size, 0u);
+    ASSERT_TRUE(heap.is_large_object(big_line));
+    ASSERT_TRUE(heap.is_large_object(big_page));
+    ASSERT_FALSE(heap.is_large_object((char*)big_page - HEAP_ALIGN));
+    ASSERT_TRUE(gc.verify(&heap));
+    gc.free(big_line, &heap);
+    gc.free(big_page, &heap);
+    ASSERT_EQ(heap.large_object_count(), 0u);
+}
+
+// Best-fit picks the smallest hole that fits where first-fit takes the first one
+TEST_F(GCHeapTest, Best_Fit_Policy) {
+    void* big_hole = gc.malloc(96, &heap);
+    gc.malloc(16, &heap);
+    void* small_hole = gc.malloc(32, &heap);
+    gc.malloc(16, &heap);
+    gc.free(big_hole, &heap);
+    gc.free(small_hole, &heap);
+
+    void* first = gc.malloc(32, &heap);
+    ASSERT_EQ(first, big_hole);
+    gc.free(first, &heap);
+
+    heap.set_policy(Heap::BEST_FIT);
+    void* best = gc.malloc(32, &heap);
+    ASSERT_EQ(best, small_hole);
+    void* next = gc.malloc(96, &heap);
+    ASSERT_EQ(next, big_hole);
+
+    // The trees follow frees and collections
+    gc.free(next, &heap);
+    gc.delete_reference(best);
+    gc.ms_collect(&heap);
+    ASSERT_EQ(gc.malloc(32, &heap), small_hole);
+    ASSERT_NE(gc.malloc(1000, &heap), nullptr);
+}
+
+// Next-fit resumes after the last hit instead of rescanning fragments near the head
+TEST_F(GCHeapTest, Next_Fit_Policy) {
+    const size_t heapSize = 1 << 16;
+    const size_t holes = 256, holeSize = 16, blockSize = 48;
+    size_t counts[2];
+
+    for (int run = 0; run < 2; ++run) {
+        Heap fragmented(heapSize);
+        GarbageCollector local;
+        if (run == 1) fragmented.set_policy(Heap::NEXT_FIT);
+
+        // Leave a run of small holes at the bottom of the heap
+        std::vector<void*> holePtrs;
+        for (size_t i = 0; i < holes; ++i) {
+            holePtrs.push_back(local.malloc(holeSize, &fragmented));
+            local.malloc(holeSize, &fragmented);
+        }
+        local.free_many(holePtrs.data(), holePtrs.size(), &fragmented);
+
+        size_t count = 0;
+        while (local.malloc(blockSize, &fragmented)) count++;
+        counts[run] = count;
+
+        ASSERT_LT(fragmented.available_memory(), holes * holeSize + blockSize);
+        fragmented.reset();
+    }
+
+    // Both policies fill the heap with the same number of blocks (BM_Fill_Fragmented times them)
+    ASSERT_EQ(counts[0], counts[1]);
+}
+
+// An aligned block carved from the next-fit rover's block moves the rover along
+TEST_F(GCHeapTest, Next_Fit_Aligned_Malloc) {
+    heap.set_policy(Heap::NEXT_FIT);
+    string error;
+    // A hole whose payload is already 64-aligned, left as the rover by the next search
+    void* pad = heap.my_malloc(32);
+    void* hole = heap.my_malloc(48);
+    void* fence = heap.my_malloc(8);
+    heap.my_free(hole);
+    void* after = heap.my_malloc(64);
+    void* aligned = heap.my_aligned_malloc(56, 64);
+    ASSERT_EQ(aligned, hole);
+    ASSERT_TRUE(heap.verify(&error)) << error;
+
+    // Allocation resumes from a free block, and everything frees cleanly
+    void* next = heap.my_malloc(32);
+    ASSERT_NE(next, nullptr);
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    for (void* ptr : { pad, fence, after, aligned, next }) {
+        heap.my_free(ptr);
+    }
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    ASSERT_EQ(heap.available_memory(), initial_free_space());
+}
+
+// Slab size classes bypass the allocation map and sweep through bitmaps
+TEST_F(GCHeapTest, Slab_Size_Class) {
+    Heap slabbed(1 << 16);
+    slabbed.add_size_class(32);
+    const size_t initial = slabbed.available_memory();
+
+    // A chain of slab objects hanging off a regular block
+    void* anchor = gc.malloc(100, &slabbed);
+    std::vector<void*> chain;
+    for (size_t i = 0; i < 100; ++i) {
+        chain.push_back(gc.malloc(32, &slabbed));
+        ASSERT_EQ((uintptr_t)chain.back() % HEAP_ALIGN, 0u);
+        ASSERT_TRUE(slabbed.is_slab_object(chain.back()));
+        gc.add_nested_reference(i ? chain[i-1] : anchor, chain[i]);
+        gc.delete_reference(chain[i]);
+    }
+    ASSERT_FALSE(slabbed.is_slab_object(anchor));
+    ASSERT_EQ(slabbed.slab_count(), 2u);
+    ASSERT_EQ(slabbed.large_object_count(), 0u);
+    ASSERT_LT(slabbed.available_memory(), initial - 2 * SLAB_SLOTS * 32);
+    ASSERT_TRUE(gc.ms_collect(&slabbed).empty());
+
+    // Cutting the chain frees its tail; slabs with survivors stay
+    ((void**)chain[49])[0] = NULL;
+    ASSERT_EQ(gc.ms_collect(&slabbed).size(), 50u);
+    ASSERT_EQ(slabbed.slab_count(), 1u);
+    void* reused = gc.malloc(32, &slabbed);
+    ASSERT_TRUE(slabbed.is_slab_object(reused));
+
+    gc.delete_reference(reused);
+    gc.delete_reference(anchor);
+    gc.ms_collect(&slabbed);
+    ASSERT_EQ(slabbed.slab_count(), 0u);
+    ASSERT_EQ(slabbed.available_memory(), initial);
+}
+
+// Headers are a single word and pointer-free blocks are not scanned
+TEST_F(GCHeapTest, Compact_Header) {
+    ASSERT_EQ(sizeof(GarbageCollector::allocation), 8u);
+
+    void* data = gc.malloc_atomic(64, &heap);
+    void* hidden = gc.malloc(16, &heap);
+    ((void**)data)[0] = hidden;
+    gc.delete_reference(hidden);
+
+    // The pointer stored in the atomic block does not keep its target alive
+    list<void*> freed = gc.ms_collect(&heap);
+    ASSERT_EQ(freed.size(), 1u);
+    ASSERT_EQ(freed.front(), hidden);
+
+    GarbageCollector::allocation* header =
+        (GarbageCollector::allocation*)((char*)data - sizeof(GarbageCollector::allocation));
+    ASSERT_EQ(header->size, Heap::align_size(64));
+    ASSERT_TRUE(header->pointer_free);
+    ASSERT_EQ(header->age, 1u);
+}
+
+// The free space counters agree with a walk of the free list under every policy
+TEST_F(GCHeapTest, Free_Space_Counters) {
+    const Heap::alloc_policy_t policies[] = { Heap::FIRST_FIT, Heap::BEST_FIT, Heap::NEXT_FIT };
+    for (Heap::alloc_policy_t policy : policies) {
+        Heap counted(1 << 16);
+        counted.set_policy(policy);
+        ASSERT_EQ(counted.free_block_count(), 1u);
+        ASSERT_EQ(counted.largest_free_block(), counted.available_memory());
+        ASSERT_EQ(counted.used_memory(), 0u);
+        ASSERT_EQ(counted.fragmentation(), 0.0);
+
+        // Punch holes of different sizes, then mix in every allocation path
+        std::vector<void*> blocks;
+        for (size_t i = 0; i < 64; ++i) {
+            blocks.push_back(counted.my_malloc(16 + 16 * (i % 8)));
+        }
+        for (size_t i = 0; i < blocks.size(); i += 2) {
+            counted.my_free(blocks[i]);
+        }
+        void* batch[16];
+        ASSERT_EQ(counted.my_malloc_n(16, 24, batch), 16u);
+        void* aligned = counted.my_aligned_malloc(40, 256);
+        ASSERT_NE(aligned, nullptr);
+        counted.free_many(batch, 8);
+
+        size_t bytes = 0, count = 0, largest = 0;
+        for (Heap::node_t* p = counted.head; p != counted.tail; p = p->next) {
+            bytes += p->size;
+            count++;
+            largest = std::max(largest, p->size);
+        }
+        ASSERT_EQ(counted.available_memory(), bytes);
+        ASSERT_EQ(counted.free_block_count(), count);
+        ASSERT_EQ(counted.largest_free_block(), largest);
+        ASSERT_EQ(counted.used_memory() + bytes + count * sizeof(Heap::node_t),
+                  counted.heap_size - (HEAP_ALIGN - sizeof(GarbageCollector::allocation)));
+        ASSERT_GT(counted.fragmentation(), 0.0);
+        ASSERT_LT(counted.fragmentation(), 1.0);
+    }
+}
+
+// Each collection reports its phases and counters, and the totals accumulate
+TEST_F(GCHeapTest, GC_Stats) {
+    // A rooted chain of three blocks and two unreachable ones
+    void* a = gc.malloc(64, &heap);
+    void* b = gc.malloc(32, &heap);
+    void* c = gc.malloc(16, &heap);
+    gc.add_nested_reference(a, b);
+    gc.add_nested_reference(b, c);
+    gc.delete_reference(b);
+    gc.delete_reference(c);
+    void* d = gc.malloc(48, &heap);
+    void* e = gc.malloc(80, &heap);
+    gc.delete_reference(d);
+    gc.delete_reference(e);
+
+    gc.ms_collect(&heap);
+    const GcStats& ms = gc.last_stats();
+    ASSERT_EQ(ms.kind, GcStats::MARK_SWEEP);
+    ASSERT_EQ(ms.objects_marked, 3u);
+    ASSERT_EQ(ms.bytes_marked, Heap::align_size(64) + Heap::align_size(32) + Heap::align_size(16));
+    ASSERT_EQ(ms.objects_freed, 2u);
+    ASSERT_EQ(ms.bytes_freed, Heap::align_size(48) + Heap::align_size(80));
+    ASSERT_EQ(ms.words_scanned, ms.bytes_marked / sizeof(uintptr_t));
+    ASSERT_GE(ms.pause_ns, ms.clear_ns + ms.root_scan_ns + ms.mark_ns + ms.sweep_ns + ms.coalesce_ns);
+
+    // Dropping the root makes the chain garbage for reference counting
+    gc.delete_reference(a);
+    gc.rc_collect(&heap);
+    const GcStats& rc = gc.last_stats();
+    ASSERT_EQ(rc.kind, GcStats::REF_COUNT);
+    ASSERT_EQ(rc.objects_marked, 0u);
+    ASSERT_EQ(rc.objects_freed, 1u);
+    ASSERT_EQ(rc.bytes_freed, Heap::align_size(64));
+
+    const GcTotals& totals = gc.total_stats();
+    ASSERT_EQ(totals.collections, 2u);
+    ASSERT_EQ(totals.ms_collections, 1u);
+    ASSERT_EQ(totals.rc_collections, 1u);
+    ASSERT_EQ(totals.objects_freed, 3u);
+    ASSERT_EQ(totals.pause_ns.count, 2u);
+    ASSERT_EQ(totals.mark_ns.count, 1u);
+    ASSERT_LE(totals.pause_ns.quantile(0.5), totals.pause_ns.max);
+    ASSERT_GE(totals.pause_ns.quantile(1.0), totals.pause_ns.min);
+
+    gc.reset_stats();
+    ASSERT_EQ(gc.total_stats().collections, 0u);
+    ASSERT_EQ(gc.total_stats().pause_ns.count, 0u);
+}
+
+// The log2 histogram buckets samples by power of two
+TEST(GcHistogramTest, Quantiles) {
+    GcHistogram histogram;
+    ASSERT_EQ(histogram.quantile(0.5), 0u);
+    for (uint64_t value = 1; value <= 1000; ++value) {
+        histogram.record(value);
+    }
+    ASSERT_EQ(histogram.count, 1000u);
+    ASSERT_EQ(histogram.min, 1u);
+    ASSERT_EQ(histogram.max, 1000u);
+    ASSERT_DOUBLE_EQ(histogram.mean(), 500.5);
+    ASSERT_EQ(histogram.quantile(0.5), 511u);
+    ASSERT_EQ(histogram.quantile(0.99), 1000u);
+}
+
+// Trace records survive a round trip through the binary file and convert to JSON
+TEST_F(GCHeapTest, GC_Trace_Round_Trip) {
+    gc_trace_clear();
+    gc_trace_emit(TRACE_MS_COLLECT, 'B');
+    gc_trace_emit(TRACE_MALLOC, 'i', 100, 0x1000);
+    gc_trace_emit(TRACE_MS_COLLECT, 'E', 3, 96);
+
+    char path[] = "/tmp/gc_trace_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_EQ(gc_trace_write(path), 3);
+
+    vector<gc_trace_record> records;
+    ASSERT_TRUE(gc_trace_read(path, records));
+    unlink(path);
+    ASSERT_EQ(records.size(), 3u);
+    ASSERT_EQ(records[1].event, TRACE_MALLOC);
+    ASSERT_EQ(records[1].phase, 'i');
+    ASSERT_EQ(records[1].arg0, 100u);
+    ASSERT_EQ(records[1].arg1, 0x1000u);
+    ASSERT_LE(records[0].timestamp_ns, records[2].timestamp_ns);
+
+    ostringstream json;
+    gc_trace_to_json(records, json);
+    ASSERT_NE(json.str().find("\"name\":\"ms_collect\",\"cat\":\"gc\",\"ph\":\"B\""), string::npos);
+    ASSERT_NE(json.str().find("\"args\":{\"arg0\":100,\"arg1\":4096}"), string::npos);
+
+    // Clearing while another thread traces keeps the records it writes afterwards
+    std::thread tracer([] {
+        for (uint64_t i = 0; i < 4 * GC_TRACE_RING_RECORDS; i++) gc_trace_emit(TRACE_FREE, 'i', i);
+    });
+    gc_trace_clear();
+    tracer.join();
+    long kept = gc_trace_write(path);
+    ASSERT_GE(kept, 0);
+    ASSERT_LE(kept, GC_TRACE_RING_RECORDS);
+    ASSERT_TRUE(gc_trace_read(path, records));
+    for (size_t i = 1; i < records.size(); i++) {
+        ASSERT_EQ(records[i].arg0, records[i - 1].arg0 + 1);
+    }
+    gc_trace_clear();
+    gc_trace_emit(TRACE_MALLOC, 'i');
+    ASSERT_EQ(gc_trace_write(path), 1);
+    unlink(path);
+
+#ifdef GC_TRACE
+    // With trace points compiled in, a collection records its phases
+    gc_trace_clear();
+    gc.delete_reference(gc.malloc(16, &heap));
+    gc.ms_collect(&heap);
+    ASSERT_GT(gc_trace_write(path), 0);
+    ASSERT_TRUE(gc_trace_read(path, records));
+    unlink(path);
+    ASSERT_EQ(records.front().event, TRACE_MALLOC);
+    ASSERT_EQ(records.back().event, TRACE_MS_COLLECT);
+    ASSERT_EQ(records.back().arg0, 1u);
+    size_t phases = 0;
+    for (const gc_trace_record& record : records) {
+        if (record.event >= TRACE_CLEAR && record.event <= TRACE_COALESCE && record.phase == 'E') {
+            phases++;
+        }
+    }
+    ASSERT_GE(phases, 5u);
+#endif
+
+    ASSERT_FALSE(gc_trace_read("/nonexistent/trace.bin", records));
+}
+
+// A recorded session replays with the same outcome, under any policy
+TEST_F(GCHeapTest, Record_And_Replay) {
+    char path[] = "/tmp/gc_record_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    heap.large_threshold = SIZE_MAX;
+    ASSERT_TRUE(gc.start_recording(path));
+    void* a = gc.malloc(64, &heap);
+    void* b = gc.malloc(32, &heap);
+    void* c = gc.malloc(100, &heap);
+    gc.add_nested_reference(a, b);
+    gc.delete_reference(b);
+    gc.delete_reference(c);
+    gc.ms_collect(&heap);                 // frees c
+    void* d = gc.malloc(5000, &heap);     // fails: larger than the heap
+    ASSERT_EQ(d, nullptr);
+    gc.add_reference(a);
+    gc.delete_reference(a);
+    gc.delete_reference(a);
+    gc.rc_collect(&heap);                 // frees a; b keeps the count from a's field
+    void* e = gc.malloc(16, &heap);
+    gc.free(e, &heap);
+    void* f = gc.malloc_atomic(24, &heap);
+    void* g = gc.aligned_malloc(40, 64, &heap);
+    ASSERT_TRUE(gc.stop_recording());
+
+    // Block layout relative to the first block, with each block's pointer_free flag
+    auto layout = [](Heap& h) {
+        vector<void*> blocks;
+        h.verify(NULL, &blocks);
+        vector<pair<ptrdiff_t, bool>> result;
+        for (void* block : blocks) {
+            GarbageCollector::allocation* header = (GarbageCollector::allocation*)((char*)block - sizeof(GarbageCollector::allocation));
+            result.push_back({ (char*)block - (char*)blocks[0], (bool)header->pointer_free });
+        }
+        return result;
+    };
+    ASSERT_EQ((uintptr_t)g % 64, 0u);
+    (void)f;
+
+    const Heap::alloc_policy_t policies[] = { Heap::FIRST_FIT, Heap::BEST_FIT, Heap::NEXT_FIT };
+    for (Heap::alloc_policy_t policy : policies) {
+        Heap replay_heap;
+        replay_heap.large_threshold = SIZE_MAX;
+        replay_heap.set_policy(policy);
+        GarbageCollector replay_gc;
+        replay_result result;
+        ASSERT_TRUE(replay_trace(path, replay_gc, replay_heap, result));
+        ASSERT_EQ(result.allocations, 7u);
+        ASSERT_EQ(result.failed_allocations, 1u);
+        ASSERT_EQ(result.collections, 2u);
+        ASSERT_EQ(result.operations, 16u);
+        ASSERT_EQ(replay_heap.available_memory(), heap.available_memory());
+        if (policy == Heap::FIRST_FIT) {
+            // Atomic and aligned allocations replay through their own functions
+            ASSERT_EQ(layout(replay_heap), layout(heap));
+        }
+        ASSERT_LE(result.min_available, initial_free_space() - 3 * 40);
+        ASSERT_GT(result.peak_rss_kb, 0);
+    }
+
+    // Collections the pacer ran are replayed only when the replay has no pacer
+    ASSERT_TRUE(gc.start_recording(path));
+    size_t before = gc.total_stats().collections;
+    gc.set_gc_percent(100);
+    for (int i = 0; i < 200; i++) {
+        gc.delete_reference(gc.malloc(64, &heap));
+    }
+    gc.set_gc_percent(-1);
+    ASSERT_TRUE(gc.stop_recording());
+    size_t paced = gc.total_stats().collections - before;
+    ASSERT_GT(paced, 0u);
+    for (int percent : { -1, 100 }) {
+        Heap replay_heap;
+        GarbageCollector replay_gc;
+        replay_gc.set_gc_percent(percent);
+        replay_result result;
+        ASSERT_TRUE(replay_trace(path, replay_gc, replay_heap, result));
+        ASSERT_EQ(result.skipped_collections, percent < 0 ? 0u : paced);
+        if (percent < 0) {
+            ASSERT_EQ(result.collections, paced);
+        }
+        ASSERT_EQ(result.collections, replay_gc.total_stats().collections);
+        ASSERT_GT(result.collections, 0u);
+    }
+    unlink(path);
+
+    replay_result result;
+    ASSERT_FALSE(replay_trace("/nonexistent/trace", gc, heap, result));
+}
+
+// Every generated shape allocates, links and keeps alive what its parameters say
+TEST(WorkloadTest, Shapes_Survive_As_Expected) {
+    workload_shape_t shapes[] = { SHAPE_LIST, SHAPE_TREE, SHAPE_DAG, SHAPE_CYCLES, SHAPE_POWER_LAW };
+    for (workload_shape_t shape : shapes) {
+        Heap heap(1 << 20);
+        GarbageCollector gc;
+        GcWorkloadSink sink(gc, &heap);
+        workload_params params;
+        params.shape = shape;
+        params.objects = 1000;
+        params.component = 100;
+        params.survival = 0.3;
+        workload_result result = generate_workload(params, sink);
+        ASSERT_EQ(result.failed, 0u);
+        ASSERT_EQ(result.components, 10u);
+        ASSERT_EQ(result.roots, 3u);
+        ASSERT_EQ(result.survivors, 300u) << workload_shape_name(shape);
+
+        gc.ms_collect(&heap);
+        ASSERT_EQ(gc.last_stats().objects_marked, 300u) << workload_shape_name(shape);
+        ASSERT_EQ(gc.last_stats().objects_freed, 700u) << workload_shape_name(shape);
+
+        sink.release_roots();
+        gc.ms_collect(&heap);
+        ASSERT_EQ(gc.last_stats().objects_freed, 300u);
+    }
+
+    // The script form names objects by id and writes every edge once
+    stringstream script;
+    ScriptWorkloadSink sink(script);
+    workload_params params;
+    params.shape = SHAPE_TREE;
+    params.objects = 3;
+    params.survival = 0;
+    workload_result result = generate_workload(params, sink);
+    ASSERT_EQ(result.edges, 2u);
+    ASSERT_EQ(script.str(), "alloc o0 32\nalloc o1 32\nalloc o2 32\n"
+                            "ref o0 o1 0\nref o0 o2 1\ndelref o1\ndelref o2\ndelref o0\n");
+}
+
+// Nested references can target any pointer field inside the source block
+TEST_F(GCHeapTest, Nested_Reference_Field) {
+    void* a = gc.malloc(16, &heap);
+    void* b = gc.malloc(16, &heap);
+    ASSERT_EQ(gc.add_nested_reference(a, b, 1), 0);
+    ASSERT_EQ(((void **)a)[1], b);
+    // Blocks are rounded up, so the first field outside is past the padding
+    ASSERT_EQ(gc.add_nested_reference(a, b, Heap::align_size(16) / sizeof(void *)), -1);
+}
+
+// A snapshot round-trips and its analysis finds dominators and retained sizes
+TEST_F(GCHeapTest, Snapshot_Dominators) {
+    // a -> b -> d and a -> c -> d: only a dominates d. e is garbage.
+    void* objects[5];
+    for (void*& object : objects) {
+        object = gc.malloc(32, &heap);
+        memset(object, 0, 32);
+    }
+    void *a = objects[0], *b = objects[1], *c = objects[2], *d = objects[3], *e = objects[4];
+    gc.add_nested_reference(a, b, 0);
+    gc.add_nested_reference(a, c, 1);
+    gc.add_nested_reference(b, d);
+    gc.add_nested_reference(c, d);
+    for (void* object : { b, c, d, e }) {
+        gc.delete_reference(object);
+    }
+
+    char path[] = "/tmp/gc_snapshot_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_TRUE(gc.dump_snapshot(path, &heap));
+    heap_snapshot snapshot;
+    ASSERT_TRUE(read_snapshot(path, snapshot));
+    unlink(path);
+    ASSERT_EQ(snapshot.blocks.size(), 5u);
+    ASSERT_EQ(snapshot.edges.size(), 4u);
+    ASSERT_EQ(snapshot.roots.size(), 1u);
+
+    // Blocks are numbered in address order
+    auto index = [&](void* ptr) {
+        for (size_t i = 0; i < snapshot.blocks.size(); i++) {
+            if (snapshot.blocks[i].address == (uintptr_t)ptr) return i;
+        }
+        return SNAPSHOT_UNREACHABLE;
+    };
+    size_t size = snapshot.blocks[index(a)].size;
+    ASSERT_EQ(size, Heap::align_size(32));
+
+    snapshot_analysis analysis;
+    analyze_snapshot(snapshot, analysis);
+    ASSERT_EQ(analysis.reachable_blocks, 4u);
+    ASSERT_EQ(analysis.unreachable_blocks, 1u);
+    ASSERT_EQ(analysis.unreachable_bytes, size);
+    ASSERT_EQ(analysis.idom[index(a)], snapshot.blocks.size());
+    ASSERT_EQ(analysis.idom[index(b)], index(a));
+    ASSERT_EQ(analysis.idom[index(d)], index(a));
+    ASSERT_EQ(analysis.idom[index(e)], SNAPSHOT_UNREACHABLE);
+    ASSERT_EQ(analysis.retained[index(a)], 4 * size);
+    ASSERT_EQ(analysis.retained[index(b)], size);
+    ASSERT_EQ(top_retainers(analysis, 1)[0], index(a));
+
+    ASSERT_FALSE(read_snapshot("/nonexistent/snapshot", snapshot));
+}
+
+// The verifiers accept a healthy heap and report corrupt headers, lists and bookkeeping
+TEST_F(GCHeapTest, Verify_Detects_Corruption) {
+    string error;
+    void* a = gc.malloc(32, &heap);
+    void* b = gc.malloc(64, &heap);
+    void* c = gc.malloc(32, &heap);
+    gc.delete_reference(b);
+    gc.ms_collect(&heap);
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    ASSERT_TRUE(gc.verify(&heap, &error)) << error;
+
+    vector<void*> blocks;
+    ASSERT_TRUE(heap.verify(NULL, &blocks));
+    ASSERT_EQ(blocks, (vector<void*>{ a, c }));
+
+    // A header overwritten by a buffer overflow in the previous block
+    GarbageCollector::allocation* header = (GarbageCollector::allocation*)((char*)c - sizeof(GarbageCollector::allocation));
+    GarbageCollector::allocation saved = *header;
+    header->size = 1000;
+    ASSERT_FALSE(heap.verify(&error));
+    ASSERT_NE(error.find("corrupt header"), string::npos) << error;
+    *header = saved;
+
+    // A free block that bypassed coalescing
+    Heap::node_t* free_block = heap.head;
+    size_t free_size = free_block->size;
+    free_block->size -= 32;
+    ASSERT_FALSE(heap.verify(&error));
+    free_block->size = free_size;
+    ASSERT_TRUE(heap.verify());
+
+    // Freeing behind the collector's back leaves a stale allocation
+    heap.my_free(c);
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    ASSERT_FALSE(gc.verify(&heap, &error));
+    ASSERT_NE(error.find("not an allocated block"), string::npos) << error;
+    (void)a;
+}
+
+// Two distinct allocation sites for the profiler
+__attribute__((noinline)) static void* profiled_site_a(GarbageCollector& gc, Heap* heap) {
+    return gc.malloc(32, heap);
+}
+
+__attribute__((noinline)) static void* profiled_site_b(GarbageCollector& gc, Heap* heap) {
+    return gc.malloc(48, heap);
+}
+
+// Sampled sites add up per backtrace, track survival and write a pprof header
+TEST_F(GCHeapTest, Allocation_Profile) {
+    ASSERT_EQ(gc.allocation_profile(), nullptr);
+    gc.start_profiling(1); // Sample everything
+    for (int i = 0; i < 3; i++) {
+        ASSERT_NE(profiled_site_a(gc, &heap), nullptr);
+    }
+    void* young[2];
+    for (void*& object : young) {
+        object = profiled_site_b(gc, &heap);
+        ASSERT_NE(object, nullptr);
+    }
+    for (void* object : young) {
+        gc.delete_reference(object);
+    }
+    gc.ms_collect(&heap);
+
+    const AllocationProfiler* profile = gc.allocation_profile();
+    ASSERT_NE(profile, nullptr);
+    const vector<profile_site>& sites = profile->sites();
+    ASSERT_EQ(sites.size(), 2u);
+    ASSERT_EQ(sites[0].alloc_objects, 3u);
+    ASSERT_EQ(sites[0].alloc_bytes, 96u);
+    ASSERT_EQ(sites[0].live_objects, 3u);
+    ASSERT_EQ(sites[0].survived, 3u);
+    ASSERT_EQ(sites[1].alloc_objects, 2u);
+    ASSERT_EQ(sites[1].live_bytes, 0u);
+    ASSERT_EQ(sites[1].freed_young, 2u);
+
+    char path[] = "/tmp/gc_profile_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    ASSERT_TRUE(profile->write_pprof(path));
+    ifstream in(path);
+    string header;
+    getline(in, header);
+    unlink(path);
+    ASSERT_EQ(header.rfind("heap profile: 3: 96 [5: 192]", 0), 0u) << header;
+    ASSERT_NE(header.find("@ heap_v2/1"), string::npos) << header;
+
+    gc.stop_profiling();
+    ASSERT_EQ(gc.allocation_profile(), nullptr);
+}
+
+// The pacer collects short-lived garbage on its own and still fails when live data does not fit
+TEST_F(GCHeapTest, Pacer_Collects_Automatically) {
+    ASSERT_EQ(gc.next_collection(), SIZE_MAX);
+    ASSERT_EQ(gc.set_gc_percent(100), -1);
+    size_t freed = 0;
+    gc.set_collection_hook([&](const list<void*>& deleted) { freed += deleted.size(); });
+
+    // Ten heaps' worth of short-lived objects never fill the heap
+    for (int i = 0; i < 10 * HEAP_SIZE / 64; i++) {
+        size_t slot;
+        ASSERT_NE(gc.malloc(32, &heap, &slot), nullptr) << "allocation " << i;
+        gc.release_reference(slot);
+        ASSERT_LE(gc.next_collection(), (size_t)GC_MIN_TRIGGER);
+    }
+    ASSERT_GT(gc.total_stats().ms_collections, 0u);
+    ASSERT_EQ(freed, gc.total_stats().objects_freed);
+    ASSERT_EQ(heap.heap_size, (size_t)HEAP_SIZE); // Nothing to grow into
+    ASSERT_FALSE(heap.grow(HEAP_ALIGN));
+
+    // Live data that does not fit still fails once collecting cannot help
+    gc.set_gc_percent(-1);
+    gc.ms_collect(&heap);
+    size_t live = 0;
+    while (gc.malloc(32, &heap)) live++;
+    gc.set_gc_percent(100);
+    ASSERT_EQ(gc.malloc(32, &heap), nullptr);
+    ASSERT_LT(live * Heap::align_size(32), (size_t)HEAP_SIZE);
+}
+
+// Exposes the pacer's retry step
+struct PacedCollector : GarbageCollector {
+    using GarbageCollector::make_room;
+};
+
+// Checks that a batch the pacer has to collect for never hands out a block twice
+TEST_F(GCHeapTest, Pacer_Malloc_N_Distinct) {
+    gc.set_gc_percent(100);
+    vector<void*> out(1000);
+    size_t n = gc.malloc_n(out.size(), 16, &heap, out.data());
+    ASSERT_GT(n, 0u);
+    ASSERT_EQ(set<void*>(out.begin(), out.begin() + n).size(), n);
+    string error;
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    ASSERT_TRUE(gc.verify(&heap, &error)) << error;
+
+    // With garbage to reclaim, the retry gets the whole batch
+    for (size_t i = 0; i < n; i++) {
+        gc.delete_reference(out[i]);
+    }
+    size_t m = gc.malloc_n(n, 16, &heap, out.data());
+    ASSERT_EQ(m, n);
+    ASSERT_EQ(set<void*>(out.begin(), out.begin() + m).size(), m);
+    ASSERT_TRUE(gc.verify(&heap, &error)) << error;
+}
+
+// With a reservation, the pacer grows the heap instead of failing while everything stays live
+TEST_F(GCHeapTest, Pacer_Grows_Heap) {
+    heap.max_heap_size = 16 * HEAP_SIZE;
+    gc.set_gc_percent(100);
+    ASSERT_EQ(heap.max_size() % HEAP_ALIGN, HEAP_ALIGN - sizeof(GarbageCollector::allocation));
+
+    // A failed large object (no heap bytes needed) is collected for but never grown for
+    PacedCollector probe;
+    probe.set_gc_percent(100);
+    size_t initial = heap.heap_size;
+    ASSERT_TRUE(probe.make_room(0, &heap, 0));
+    ASSERT_FALSE(probe.make_room(0, &heap, 1));
+    ASSERT_EQ(heap.heap_size, initial);
+    ASSERT_TRUE(probe.make_room(64, &heap, 1));
+    ASSERT_GT(heap.heap_size, initial);
+
+    // Everything stays rooted, so the heap has to grow instead
+    vector<void*> live;
+    while (void* ptr = gc.malloc(48, &heap)) {
+        memset(ptr, 0xab, 48); // The grown pages are writable
+        live.push_back(ptr);
+    }
+    ASSERT_GT(heap.heap_size, (size_t)HEAP_SIZE);
+    ASSERT_LE(heap.heap_size, heap.max_size());
+    ASSERT_GT(live.size() * Heap::align_size(48), 8u * HEAP_SIZE);
+    string error;
+    ASSERT_TRUE(heap.verify(&error)) << error;
+    ASSERT_TRUE(gc.verify(&heap, &error)) << error;
+
+    // Grown space is ordinary free memory once the objects die
+    for (void* ptr : live) {
+        gc.delete_reference(ptr);
+    }
+    gc.ms_collect(&heap);
+    ASSERT_EQ(heap.free_block_count(), 1u);
+    ASSERT_EQ(heap.used_memory(), 0u);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <gc.h>
+#include <heap.h>
+#include <recorder.h>
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s <trace> [options]\n"
+            "  --heap BYTES             Size of the free-list heap (default %d)\n"
+            "  --policy first|best|next Placement policy (default first)\n"
+            "  --slab SIZE              Add a slab size class (repeatable)\n"
+            "  --large-threshold BYTES  Smallest request sent to the large object space\n"
+            "  --pages normal|thp|hugetlb  Page backing of the heap\n"
+            "  --scavenge BYTES         Free bytes kept resident after each collection\n"
+            "  --gc-percent N           Run the pacer at N%% (recorded paced collections are skipped)\n"
+            "  --max-heap BYTES         Size the pacer may grow the heap to (default --heap)\n"
+            "  --conservative           Scan this thread's stack instead of rooting new objects\n"
+            "  --json                   Print the result as one JSON object\n",
+            name, HEAP_SIZE);
+}
+
+/**
+ * Replays an allocation trace recorded with GarbageCollector::start_recording()
+ * against the heap configuration given on the command line and reports
+ * time, peak RSS and fragmentation.
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    size_t heap_size = HEAP_SIZE;
+    Heap::alloc_policy_t policy = Heap::FIRST_FIT;
+    Heap::page_mode_t pages = Heap::PAGES_NORMAL;
+    vector<size_t> size_classes;
+    size_t large_threshold = 0;
+    size_t scavenge_retain = SIZE_MAX;
+    int gc_percent = -1;
+    size_t max_heap_size = 0;
+    bool conservative = false;
+    bool json = false;
+
+    for (int i = 2; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--json") == 0) {
+            json = true;
+            continue;
+        }
+        if (strcmp(arg, "--conservative") == 0) {
+            conservative = true;
+            continue;
+        }
+        if (value == NULL) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+        if (strcmp(arg, "--heap") == 0) {
+            heap_size = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--policy") == 0) {
+            if (strcmp(value, "first") == 0) policy = Heap::FIRST_FIT;
+            else if (strcmp(value, "best") == 0) policy = Heap::BEST_FIT;
+            else if (strcmp(value, "next") == 0) policy = Heap::NEXT_FIT;
+            else { usage(argv[0]); return 2; }
+        } else if (strcmp(arg, "--slab") == 0) {
+            size_classes.push_back(strtoull(value, NULL, 0));
+        } else if (strcmp(arg, "--large-threshold") == 0) {
+            large_threshold = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--pages") == 0) {
+            if (strcmp(value, "normal") == 0) pages = Heap::PAGES_NORMAL;
+            else if (strcmp(value, "thp") == 0) pages = Heap::PAGES_TRANSPARENT_HUGE;
+            else if (strcmp(value, "hugetlb") == 0) pages = Heap::PAGES_HUGETLB;
+            else { usage(argv[0]); return 2; }
+        } else if (strcmp(arg, "--scavenge") == 0) {
+            scavenge_retain = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--gc-percent") == 0) {
+            gc_percent = atoi(value);
+        } else if (strcmp(arg, "--max-heap") == 0) {
+            max_heap_size = strtoull(value, NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    Heap heap(heap_size, pages);
+    heap.set_policy(policy);
+    for (size_t size : size_classes) {
+        heap.add_size_class(size);
+    }
+    if (large_threshold) {
+        heap.large_threshold = large_threshold;
+    }
+    heap.scavenge_retain = scavenge_retain;
+    heap.max_heap_size = max_heap_size;
+    GarbageCollector gc;
+    gc.set_gc_percent(gc_percent);
+    if (conservative) {
+        gc.set_conservative_roots(true);
+        gc.register_thread();
+    }
+
+    replay_result result;
+    if (!replay_trace(argv[1], gc, heap, result)) {
+        fprintf(stderr, "Cannot replay %s: missing or malformed trace (stopped after %zu operations)\n",
+                argv[1], result.operations);
+        return 1;
+    }
+
+    if (json) {
+        printf("{\"operations\":%zu,\"allocations\":%zu,\"failed_allocations\":%zu,"
+               "\"collections\":%zu,\"skipped_collections\":%zu,\"seconds\":%.6f,\"gc_seconds\":%.6f,"
+               "\"min_available\":%zu,\"max_fragmentation\":%.4f,\"end_fragmentation\":%.4f,"
+               "\"peak_rss_kb\":%ld}\n",
+               result.operations, result.allocations, result.failed_allocations,
+               result.collections, result.skipped_collections, result.seconds, result.gc_seconds,
+               result.min_available, result.max_fragmentation, result.end_fragmentation, result.peak_rss_kb);
+    } else {
+        printf("Operations:         %zu\n", result.operations);
+        printf("Allocations:        %zu (%zu failed)\n", result.allocations, result.failed_allocations);
+        printf("Collections:        %zu (%zu recorded paced ones skipped)\n", result.collections,
+               result.skipped_collections);
+        printf("Time:               %.6f s (%.6f s collecting)\n", result.seconds, result.gc_seconds);
+        printf("Peak RSS:           %ld KB\n", result.peak_rss_kb);
+        printf("Min free memory:    %zu bytes\n", result.min_available);
+        printf("Fragmentation:      %.4f max after a collection, %.4f at the end\n",
+               result.max_fragmentation, result.end_fragmentation);
+    }
+    return 0;
+}
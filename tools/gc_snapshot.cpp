@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include <snapshot.h>
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s <snapshot> [options]\n"
+            "  --top N    Number of top retainers to list (default 10)\n"
+            "  --json     Print the result as one JSON object\n",
+            name);
+}
+
+// Exclusive upper bound of a size histogram bucket, as in GcHistogram
+static size_t bucket_limit(unsigned bucket) {
+    return (size_t)1 << bucket;
+}
+
+/**
+ * Analyzes a heap snapshot written by GarbageCollector::dump_snapshot():
+ * totals of reachable and garbage blocks, a size histogram and the blocks
+ * retaining the most memory, i.e. those whose loss would free the most.
+ */
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    size_t top = 10;
+    bool json = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = strtoull(argv[++i], NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    heap_snapshot snapshot;
+    if (!read_snapshot(argv[1], snapshot)) {
+        fprintf(stderr, "Cannot read %s: missing or malformed snapshot\n", argv[1]);
+        return 1;
+    }
+    snapshot_analysis analysis;
+    analyze_snapshot(snapshot, analysis);
+    vector<size_t> retainers = top_retainers(analysis, top);
+    size_t n = snapshot.blocks.size();
+
+    if (json) {
+        printf("{\"blocks\":%zu,\"edges\":%zu,\"roots\":%zu,"
+               "\"reachable_blocks\":%zu,\"reachable_bytes\":%zu,"
+               "\"unreachable_blocks\":%zu,\"unreachable_bytes\":%zu,\"sizes\":[",
+               n, snapshot.edges.size(), snapshot.roots.size(),
+               analysis.reachable_blocks, analysis.reachable_bytes,
+               analysis.unreachable_blocks, analysis.unreachable_bytes);
+        const char *separator = "";
+        for (unsigned bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+            if (!analysis.size_blocks[bucket]) continue;
+            printf("%s{\"below\":%zu,\"blocks\":%zu,\"bytes\":%zu}", separator, bucket_limit(bucket),
+                   analysis.size_blocks[bucket], analysis.size_bytes[bucket]);
+            separator = ",";
+        }
+        printf("],\"top_retainers\":[");
+        separator = "";
+        for (size_t block : retainers) {
+            size_t idom = analysis.idom[block];
+            printf("%s{\"address\":\"0x%lx\",\"size\":%zu,\"retained\":%zu,\"dominator\":", separator,
+                   (unsigned long)snapshot.blocks[block].address, snapshot.blocks[block].size,
+                   analysis.retained[block]);
+            if (idom < n) {
+                printf("\"0x%lx\"}", (unsigned long)snapshot.blocks[idom].address);
+            } else {
+                printf("null}");
+            }
+            separator = ",";
+        }
+        printf("]}\n");
+        return 0;
+    }
+
+    printf("Blocks:       %zu (%zu edges, %zu roots)\n", n, snapshot.edges.size(), snapshot.roots.size());
+    printf("Reachable:    %zu blocks, %zu bytes\n", analysis.reachable_blocks, analysis.reachable_bytes);
+    printf("Garbage:      %zu blocks, %zu bytes\n", analysis.unreachable_blocks, analysis.unreachable_bytes);
+
+    printf("\nSize histogram:\n");
+    for (unsigned bucket = 0; bucket < GC_HISTOGRAM_BUCKETS; bucket++) {
+        if (!analysis.size_blocks[bucket]) continue;
+        printf("  < %-11zu %10zu blocks %12zu bytes\n", bucket_limit(bucket),
+               analysis.size_blocks[bucket], analysis.size_bytes[bucket]);
+    }
+
+    printf("\nTop retainers:\n");
+    printf("  %-18s %10s %12s  %s\n", "address", "size", "retained", "dominator");
+    for (size_t block : retainers) {
+        if (analysis.retained[block] == 0) break; // Only garbage left
+        size_t idom = analysis.idom[block];
+        printf("  0x%-16lx %10zu %12zu  ", (unsigned long)snapshot.blocks[block].address,
+               snapshot.blocks[block].size, analysis.retained[block]);
+        if (idom < n) {
+            printf("0x%lx\n", (unsigned long)snapshot.blocks[idom].address);
+        } else {
+            printf("(root set)\n");
+        }
+    }
+    return 0;
+}
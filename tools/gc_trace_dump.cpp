@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <fstream>
+#include <gc_trace.h>
+
+/**
+ * Converts a binary trace written by gc_trace_write() into Chrome trace
+ * JSON for chrome://tracing or ui.perfetto.dev.
+ *
+ * Usage: gc_trace_dump <trace.bin> [out.json]   (JSON goes to stdout by default)
+ */
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <trace.bin> [out.json]\n", argv[0]);
+        return 2;
+    }
+
+    vector<gc_trace_record> records;
+    if (!gc_trace_read(argv[1], records)) {
+        fprintf(stderr, "Cannot read trace file: %s\n", argv[1]);
+        return 1;
+    }
+
+    if (argc == 3) {
+        ofstream out(argv[2]);
+        if (!out) {
+            fprintf(stderr, "Cannot write: %s\n", argv[2]);
+            return 1;
+        }
+        gc_trace_to_json(records, out);
+    } else {
+        gc_trace_to_json(records, cout);
+    }
+    fprintf(stderr, "%zu records\n", records.size());
+    return 0;
+}
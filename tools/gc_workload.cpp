@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <gc.h>
+#include <heap.h>
+#include <workload.h>
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --shape list|tree|dag|cycles|power-law  Graph shape (default list)\n"
+            "  --objects N              Number of objects (default 1024)\n"
+            "  --size BYTES             Bytes per object (default 32)\n"
+            "  --fanout N               Pointer fields per object (default 4)\n"
+            "  --component N            Objects per rooted component (default: all)\n"
+            "  --survival F             Fraction of components left rooted (default 1)\n"
+            "  --alpha F                Power-law exponent (default 2)\n"
+            "  --seed N                 Random seed (default 42)\n"
+            "  --collect ms|rc|none     Collection ending the script (default ms)\n"
+            "  --out FILE               Write the script to FILE instead of stdout\n"
+            "  --run                    Build the graph in-process and report the collection\n"
+            "  --heap BYTES             Heap size for --run (default %d)\n",
+            name, HEAP_SIZE);
+}
+
+/**
+ * Generates a synthetic object graph. By default it is written as a
+ * simulator script for `marksweep_app --batch`; with --run it is built on
+ * a collector directly and one collection is measured against the number
+ * of survivors the generator expects.
+ */
+int main(int argc, char **argv) {
+    workload_params params;
+    const char *collect = "ms";
+    const char *path = NULL;
+    bool run = false;
+    size_t heap_size = HEAP_SIZE;
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--run") == 0) {
+            run = true;
+            continue;
+        }
+        if (value == NULL) {
+            usage(argv[0]);
+            return 2;
+        }
+        i++;
+        if (strcmp(arg, "--shape") == 0) {
+            if (!parse_workload_shape(value, &params.shape)) { usage(argv[0]); return 2; }
+        } else if (strcmp(arg, "--objects") == 0) {
+            params.objects = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--size") == 0) {
+            params.object_size = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--fanout") == 0) {
+            params.max_fanout = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--component") == 0) {
+            params.component = strtoull(value, NULL, 0);
+        } else if (strcmp(arg, "--survival") == 0) {
+            params.survival = strtod(value, NULL);
+        } else if (strcmp(arg, "--alpha") == 0) {
+            params.power_law_alpha = strtod(value, NULL);
+        } else if (strcmp(arg, "--seed") == 0) {
+            params.seed = strtoul(value, NULL, 0);
+        } else if (strcmp(arg, "--collect") == 0) {
+            if (strcmp(value, "ms") != 0 && strcmp(value, "rc") != 0 && strcmp(value, "none") != 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            collect = value;
+        } else if (strcmp(arg, "--out") == 0) {
+            path = value;
+        } else if (strcmp(arg, "--heap") == 0) {
+            heap_size = strtoull(value, NULL, 0);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (run) {
+        Heap heap(heap_size);
+        GarbageCollector gc;
+        GcWorkloadSink sink(gc, &heap);
+        uint64_t start = gc_now_ns();
+        workload_result result = generate_workload(params, sink);
+        uint64_t built = gc_now_ns();
+        if (strcmp(collect, "rc") == 0) {
+            gc.rc_collect(&heap);
+        } else if (strcmp(collect, "ms") == 0) {
+            gc.ms_collect(&heap);
+        }
+        const GcStats &stats = gc.last_stats();
+        printf("Shape:              %s\n", workload_shape_name(params.shape));
+        printf("Objects:            %zu (%zu failed), %zu edges\n", result.objects, result.failed, result.edges);
+        printf("Components:         %zu, %zu rooted\n", result.components, result.roots);
+        printf("Expected survivors: %zu\n", result.survivors);
+        printf("Build time:         %.6f s\n", (built - start) / 1e9);
+        if (strcmp(collect, "none") != 0) {
+            printf("Collection (%s):    %zu freed, %zu marked, pause %lu ns (mark %lu, sweep %lu)\n",
+                   collect, stats.objects_freed, stats.objects_marked,
+                   (unsigned long)stats.pause_ns, (unsigned long)stats.mark_ns, (unsigned long)stats.sweep_ns);
+        }
+        printf("Available memory:   %zu bytes, fragmentation %.4f\n",
+               heap.available_memory(), heap.fragmentation());
+        return 0;
+    }
+
+    ofstream file;
+    if (path) {
+        file.open(path);
+        if (!file) {
+            fprintf(stderr, "Cannot write %s\n", path);
+            return 1;
+        }
+    }
+    ostream &out = path ? file : cout;
+    ScriptWorkloadSink sink(out);
+    out << "# " << workload_shape_name(params.shape) << " workload, seed " << params.seed << "\n";
+    workload_result result = generate_workload(params, sink);
+    if (strcmp(collect, "none") != 0) {
+        out << collect << "\n";
+    }
+    out << "# " << result.objects << " objects, " << result.edges << " edges, "
+        << result.survivors << " expected survivors\n";
+    return out.good() ? 0 : 1;
+}